@@ -0,0 +1,146 @@
+// Slab allocator for tree nodes
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Objects are carved out of fixed-size slabs in allocation order, so the nodes
+// created for one version sit next to each other in memory. Nothing is freed
+// one at a time: release() drops every slab at once.
+template<typename T, size_t SlabSize = 4096>
+struct Arena {
+
+    static_assert(std::is_trivially_destructible<T>::value, "arena objects are released without running destructors");
+
+    std::vector<T*> slabs;
+    size_t used;
+
+    Arena() : used(SlabSize) {}
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    ~Arena() { release(); }
+
+    template<typename... Args>
+    T* create(Args&&... args) {
+        if(used == SlabSize) {
+            slabs.push_back(static_cast<T*>(::operator new(SlabSize * sizeof(T))));
+            used = 0;
+        }
+        return new(slabs.back() + used++) T(std::forward<Args>(args)...);
+    }
+
+    size_t size() const {
+        return slabs.empty() ? 0 : (slabs.size() - 1) * SlabSize + used;
+    }
+
+    // The i-th object created, in allocation order.
+    T* at(size_t i) const {
+        return slabs[i / SlabSize] + i % SlabSize;
+    }
+
+    size_t bytes() const {
+        return slabs.size() * SlabSize * sizeof(T);
+    }
+
+    void swap(Arena& other) {
+        slabs.swap(other.slabs);
+        std::swap(used, other.used);
+    }
+
+    // Hands the slabs to the caller, who frees them later with free().
+    std::vector<T*> detach() {
+        std::vector<T*> out;
+        out.swap(slabs);
+        used = SlabSize;
+        return out;
+    }
+
+    static void free(const std::vector<T*>& slabs) {
+        for(T* slab : slabs) ::operator delete(slab);
+    }
+
+    void release() {
+        free(slabs);
+        slabs.clear();
+        used = SlabSize;
+    }
+};
+
+// Arena that any number of threads can allocate from at once. Each object
+// claims the next index with one atomic increment; slabs hang off a fixed
+// directory and are installed with a compare-and-swap by whichever thread
+// first needs them, so allocation never takes a lock.
+template<typename T, size_t SlabSize = 4096, int DirectoryBits = 14>
+struct ConcurrentArena {
+
+    static_assert(std::is_trivially_destructible<T>::value, "arena objects are released without running destructors");
+
+    static const size_t MaxSlabs = size_t(1) << DirectoryBits;
+
+    std::atomic<T*> slabs[MaxSlabs];
+    std::atomic<size_t> next;
+
+    ConcurrentArena() : next(0) {
+        for(auto& slab : slabs) slab.store(nullptr, std::memory_order_relaxed);
+    }
+
+    ConcurrentArena(const ConcurrentArena&) = delete;
+    ConcurrentArena& operator=(const ConcurrentArena&) = delete;
+
+    ~ConcurrentArena() { release(); }
+
+    T* slab(size_t s) {
+        T* objects = slabs[s].load(std::memory_order_acquire);
+        if(objects != nullptr) return objects;
+        T* fresh = static_cast<T*>(::operator new(SlabSize * sizeof(T)));
+        if(slabs[s].compare_exchange_strong(objects, fresh, std::memory_order_acq_rel)) return fresh;
+        ::operator delete(fresh);
+        return objects;
+    }
+
+    template<typename... Args>
+    T* create(Args&&... args) {
+        size_t i = next.fetch_add(1, std::memory_order_relaxed);
+        if(i >= MaxSlabs * SlabSize) throw std::length_error("arena is full");
+        return new(slab(i / SlabSize) + i % SlabSize) T(std::forward<Args>(args)...);
+    }
+
+    // Objects created so far; only meaningful once the allocating threads are done.
+    size_t size() const {
+        return next.load(std::memory_order_acquire);
+    }
+
+    T* at(size_t i) const {
+        return slabs[i / SlabSize].load(std::memory_order_acquire) + i % SlabSize;
+    }
+
+    size_t bytes() const {
+        return (size() + SlabSize - 1) / SlabSize * SlabSize * sizeof(T);
+    }
+
+    std::vector<T*> detach() {
+        std::vector<T*> out;
+        next.store(0);
+        for(auto& slab : slabs) {
+            T* objects = slab.exchange(nullptr);
+            if(objects != nullptr) out.push_back(objects);
+        }
+        return out;
+    }
+
+    static void free(const std::vector<T*>& slabs) {
+        for(T* slab : slabs) ::operator delete(slab);
+    }
+
+    void release() {
+        free(detach());
+    }
+};
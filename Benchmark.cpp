@@ -0,0 +1,334 @@
+// Reproducible benchmark of the persistent trees
+//
+//   Benchmark [--tree partial|full|redblack|treap|all] [--size N,N,...] [--ops N]
+//             [--mix insert:erase:find] [--dist uniform|sorted|zipf|all]
+//             [--branch] [--seed S] [--csv] [--stats]
+//
+// Every run builds a tree of size keys and then performs ops operations drawn
+// from the mix. Updates create a version each; finds go to a uniformly random
+// version. With --branch the fully persistent trees (full and treap) derive
+// every update from a random version instead of the latest one. Each operation is timed on its own, so
+// latencies include roughly 20 ns of clock overhead. --stats prints the
+// tree's counters as JSON after each run (to stderr with --csv); they count
+// only when built with -DTREE_STATS.
+
+#include <vector>
+#include <string>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+
+#include "PartialTree.h"
+#include "FullTree.h"
+#include "RedBlackTree.h"
+#include "Treap.h"
+
+using namespace std;
+
+enum Op {
+    INSERT, ERASE, FIND
+};
+
+struct Config {
+    vector<string> trees = {"partial", "full", "redblack", "treap"};
+    vector<int> sizes = {1000, 10000, 100000};
+    vector<string> dists = {"uniform", "sorted", "zipf"};
+    int ops = 200000;
+    int mix[3] = {25, 25, 50};
+    bool branch = false;
+    bool csv = false;
+    bool stats = false;
+    uint32_t seed = 42;
+};
+
+// Keys for one run. Uniform and zipf keys come from [0, 2 * size); zipf ranks
+// are spread over that range by a fixed shuffle, so hot keys are not
+// neighbours. Sorted inserts ascend, erases remove the oldest keys and finds
+// pick among the keys inserted so far.
+struct KeyGen {
+
+    string dist;
+    int universe;
+    mt19937& gen;
+    vector<double> cdf;
+    vector<int> spread;
+    int inserted = 0, erased = 0;
+
+    KeyGen(const string& dist, int size, mt19937& gen) : dist(dist), universe(2 * size), gen(gen) {
+        if(dist != "zipf") return;
+        cdf.resize(universe);
+        double sum = 0;
+        for(int rank = 0; rank < universe; rank++) cdf[rank] = sum += 1 / pow(rank + 1, 0.99);
+        for(double& c : cdf) c /= sum;
+        spread.resize(universe);
+        iota(spread.begin(), spread.end(), 0);
+        shuffle(spread.begin(), spread.end(), gen);
+    }
+
+    int draw() {
+        if(dist == "zipf") {
+            double u = uniform_real_distribution<double>(0, 1)(gen);
+            return spread[min<size_t>(lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin(), universe - 1)];
+        }
+        return gen() % universe;
+    }
+
+    int next(Op op) {
+        if(dist != "sorted") return draw();
+        if(op == INSERT) return inserted++;
+        if(op == ERASE) return erased < inserted ? erased++ : 0;
+        return inserted == 0 ? 0 : gen() % inserted;
+    }
+};
+
+struct PartialBench {
+
+    PartialTree<int> tree;
+
+    void insert(int key, mt19937&) { tree.insert(key); }
+    void erase(int key, mt19937&) { tree.erase(key); }
+    bool find(int key, int version) { return tree.find(key, version); }
+    int versions() { return tree.currentVersion + 1; }
+    size_t nodeBytes() { return tree.nodes.bytes(); }
+    size_t bytes() { return tree.nodes.bytes() + tree.root.bytes(); }
+};
+
+struct FullBench {
+
+    FullTree<int> tree;
+    bool branch;
+
+    FullBench(bool branch) : branch(branch) {}
+
+    int parent(mt19937& gen) {
+        return branch ? gen() % (tree.lastVersion() + 1) : tree.lastVersion();
+    }
+
+    void insert(int key, mt19937& gen) { tree.insert(key, parent(gen)); }
+    void erase(int key, mt19937& gen) { tree.erase(key, parent(gen)); }
+    bool find(int key, int version) { return tree.find(key, version); }
+    int versions() { return tree.lastVersion() + 1; }
+    size_t nodeBytes() { return tree.nodes.bytes(); }
+    size_t bytes() { return tree.nodes.bytes() + tree.root.bytes() + tree.versions.bytes(); }
+};
+
+struct RedBlackBench {
+
+    RedBlackTree<int> tree;
+
+    void insert(int key, mt19937&) { tree.insert(key); }
+    void erase(int key, mt19937&) { tree.erase(key); }
+    bool find(int key, int version) { return tree.count(key, version); }
+    int versions() { return tree.latestVersion + 1; }
+    size_t nodeBytes() { return tree.nodes.bytes(); }
+    size_t bytes() { return tree.nodes.bytes() + tree.root.bytes(); }
+};
+
+struct TreapBench {
+
+    Treap<int> tree;
+    bool branch;
+
+    TreapBench(bool branch, uint32_t seed) : tree(seed), branch(branch) {}
+
+    int parent(mt19937& gen) {
+        return branch ? gen() % (tree.lastVersion() + 1) : tree.lastVersion();
+    }
+
+    void insert(int key, mt19937& gen) { tree.insert(key, parent(gen)); }
+    void erase(int key, mt19937& gen) { tree.erase(key, parent(gen)); }
+    bool find(int key, int version) { return tree.find(key, version); }
+    int versions() { return tree.lastVersion() + 1; }
+    size_t nodeBytes() { return tree.nodes.bytes(); }
+    size_t bytes() { return tree.nodes.bytes() + tree.root.bytes(); }
+};
+
+struct Latencies {
+
+    vector<uint32_t> ns;
+    double total = 0;
+
+    void add(chrono::steady_clock::duration d) {
+        double t = chrono::duration<double, nano>(d).count();
+        ns.push_back(t);
+        total += t;
+    }
+
+    uint32_t percentile(double p) {
+        if(ns.empty()) return 0;
+        size_t i = min(ns.size() - 1, size_t(p * ns.size()));
+        nth_element(ns.begin(), ns.begin() + i, ns.end());
+        return ns[i];
+    }
+
+    double throughput() {
+        return total == 0 ? 0 : ns.size() / total * 1e3;
+    }
+};
+
+static const char* opNames[] = {"insert", "erase", "find"};
+
+void header(const Config& config) {
+    if(!config.csv) return;
+    cout << "tree,size,dist,versions,hits";
+    for(auto name : opNames) cout << "," << name << "_mops," << name << "_p50," << name << "_p90," << name << "_p99," << name << "_max";
+    cout << ",node_bytes_per_version,bytes_per_version" << endl;
+}
+
+template<typename Bench>
+void run(Bench& bench, const string& name, int size, const string& dist, const Config& config) {
+
+    mt19937 gen(config.seed);
+    KeyGen keys(dist, size, gen);
+
+    for(int i = 0; i < size; i++) bench.insert(keys.next(INSERT), gen);
+
+    Latencies latency[3];
+    long long hits = 0;
+    int weights = config.mix[0] + config.mix[1] + config.mix[2];
+
+    for(int i = 0; i < config.ops; i++) {
+        int w = gen() % weights;
+        Op op = w < config.mix[0] ? INSERT : w < config.mix[0] + config.mix[1] ? ERASE : FIND;
+        int key = keys.next(op);
+        int version = op == FIND ? gen() % bench.versions() : 0;
+        auto start = chrono::steady_clock::now();
+        if(op == INSERT) bench.insert(key, gen);
+        else if(op == ERASE) bench.erase(key, gen);
+        else hits += bench.find(key, version);
+        latency[op].add(chrono::steady_clock::now() - start);
+    }
+
+    double versions = bench.versions();
+
+    auto stats = [&](ostream& out) {
+        if(!config.stats) return;
+        out << "{\"tree\": \"" << name << "\", \"size\": " << size << ", \"dist\": \"" << dist
+            << "\", \"stats\": " << bench.tree.stats.json() << "}" << endl;
+    };
+
+    if(config.csv) {
+        cout << name << "," << size << "," << dist << "," << bench.versions() << "," << hits;
+        for(auto& l : latency) {
+            cout << "," << l.throughput() << "," << l.percentile(0.5) << "," << l.percentile(0.9) << "," << l.percentile(0.99) << "," << l.percentile(1);
+        }
+        cout << "," << bench.nodeBytes() / versions << "," << bench.bytes() / versions << endl;
+        stats(cerr);
+        return;
+    }
+
+    cout << left << setw(9) << name << " size " << setw(7) << size << setw(8) << dist << right
+         << bench.versions() << " versions, " << fixed << setprecision(1)
+         << bench.nodeBytes() / versions << " B/version in nodes, " << bench.bytes() / versions << " B/version total" << endl;
+    for(int op = 0; op < 3; op++) {
+        auto& l = latency[op];
+        if(l.ns.empty()) continue;
+        cout << "    " << left << setw(7) << opNames[op] << right << setprecision(2) << setw(7) << l.throughput() << " Mops/s"
+             << "  p50 " << setw(6) << l.percentile(0.5) << "  p90 " << setw(6) << l.percentile(0.9)
+             << "  p99 " << setw(6) << l.percentile(0.99) << "  max " << setw(8) << l.percentile(1) << " ns";
+        if(op == FIND) cout << "  (" << hits << " hits)";
+        cout << endl;
+    }
+    stats(cout);
+}
+
+vector<string> split(const string& s, char sep) {
+    vector<string> parts;
+    stringstream in(s);
+    for(string part; getline(in, part, sep); ) parts.push_back(part);
+    return parts;
+}
+
+int main(int argc, char** argv) {
+
+    Config config;
+
+    for(int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool flag = arg == "--branch" || arg == "--csv" || arg == "--stats";
+        if(!flag && i + 1 == argc) {
+            cerr << arg << " needs a value" << endl;
+            return 1;
+        }
+        string value = flag ? "" : argv[i + 1];
+        try {
+            if(arg == "--tree") {
+                if(value != "all") config.trees = split(value, ',');
+                i++;
+            } else if(arg == "--size") {
+                config.sizes.clear();
+                for(auto& s : split(value, ',')) config.sizes.push_back(stoi(s));
+                i++;
+            } else if(arg == "--dist") {
+                if(value != "all") config.dists = split(value, ',');
+                i++;
+            } else if(arg == "--ops") {
+                config.ops = stoi(value);
+                i++;
+            } else if(arg == "--mix") {
+                auto parts = split(value, ':');
+                if(parts.size() != 3) {
+                    cerr << "--mix takes insert:erase:find weights" << endl;
+                    return 1;
+                }
+                for(int j = 0; j < 3; j++) config.mix[j] = stoi(parts[j]);
+                if(*min_element(config.mix, config.mix + 3) < 0 || config.mix[0] + config.mix[1] + config.mix[2] == 0) {
+                    cerr << "--mix weights must be non-negative and not all zero" << endl;
+                    return 1;
+                }
+                i++;
+            } else if(arg == "--seed") {
+                config.seed = stoul(value);
+                i++;
+            } else if(arg == "--branch") {
+                config.branch = true;
+            } else if(arg == "--csv") {
+                config.csv = true;
+            } else if(arg == "--stats") {
+                config.stats = true;
+            } else {
+                cerr << "unknown option " << arg << endl;
+                return 1;
+            }
+        } catch(const logic_error&) {
+            cerr << arg << " takes a number, not " << value << endl;
+            return 1;
+        }
+    }
+
+    header(config);
+
+    for(auto& tree : config.trees) {
+        for(int size : config.sizes) {
+            for(auto& dist : config.dists) {
+                // Sorted keys turn the unbalanced trees into a path of length size.
+                if(dist == "sorted" && (tree == "partial" || tree == "full") && size > 20000) {
+                    if(!config.csv) cout << left << setw(9) << tree << " size " << setw(7) << size << setw(8) << dist << right << "skipped: unbalanced tree would be a path" << endl;
+                    continue;
+                }
+                if(tree == "partial") {
+                    PartialBench bench;
+                    run(bench, tree, size, dist, config);
+                } else if(tree == "full") {
+                    FullBench bench(config.branch);
+                    run(bench, tree, size, dist, config);
+                } else if(tree == "redblack") {
+                    RedBlackBench bench;
+                    run(bench, tree, size, dist, config);
+                } else if(tree == "treap") {
+                    TreapBench bench(config.branch, config.seed);
+                    run(bench, tree, size, dist, config);
+                } else {
+                    cerr << "unknown tree " << tree << endl;
+                    return 1;
+                }
+            }
+        }
+    }
+}
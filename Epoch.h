@@ -0,0 +1,96 @@
+// Epoch-based reclamation for the persistent trees
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+// Readers announce the epoch they entered in; memory retired by a writer is
+// tagged with the epoch current at the time it was unlinked and only freed
+// once every reader still inside is from a later epoch. Reads never touch a
+// reference count, so they do not bounce cache lines between cores.
+struct EpochManager {
+
+    static const int MaxReaders = 128;
+
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> epoch{0};
+    };
+
+    std::atomic<uint64_t> global;
+    Slot slots[MaxReaders];
+
+    std::mutex retiredLock;
+    std::vector<std::pair<uint64_t, std::function<void()>>> retired;
+
+    EpochManager() : global(1) {}
+
+    ~EpochManager() {
+        for(auto& r : retired) r.second();
+    }
+
+    int enter() {
+        uint64_t e = global.load();
+        for(int i = 0; i < MaxReaders; i++) {
+            uint64_t idle = 0;
+            if(slots[i].epoch.compare_exchange_strong(idle, e)) return i;
+        }
+        throw std::runtime_error("too many concurrent readers");
+    }
+
+    void exit(int slot) {
+        slots[slot].epoch.store(0, std::memory_order_release);
+    }
+
+    // Frees run in collect() once no reader that could still reach the memory
+    // is inside.
+    void retire(std::function<void()> free) {
+        std::lock_guard<std::mutex> lock(retiredLock);
+        retired.emplace_back(global.fetch_add(1), std::move(free));
+    }
+
+    uint64_t oldestReader() {
+        uint64_t oldest = UINT64_MAX;
+        for(auto& s : slots) {
+            uint64_t e = s.epoch.load();
+            if(e != 0 && e < oldest) oldest = e;
+        }
+        return oldest;
+    }
+
+    void collect() {
+        std::vector<std::function<void()>> ready;
+        {
+            std::lock_guard<std::mutex> lock(retiredLock);
+            uint64_t oldest = oldestReader();
+            size_t kept = 0;
+            for(auto& r : retired) {
+                if(r.first < oldest) ready.push_back(std::move(r.second));
+                else retired[kept++] = std::move(r);
+            }
+            retired.resize(kept);
+        }
+        for(auto& free : ready) free();
+    }
+};
+
+// Keeps every node reachable at entry alive until the guard goes out of scope.
+struct ReadGuard {
+
+    EpochManager* epochs;
+    int slot;
+
+    ReadGuard(EpochManager& epochs) : epochs(&epochs), slot(epochs.enter()) {}
+
+    ReadGuard(const ReadGuard&) = delete;
+    ReadGuard& operator=(const ReadGuard&) = delete;
+
+    ReadGuard(ReadGuard&& other) : epochs(other.epochs), slot(other.slot) { other.epochs = nullptr; }
+
+    ~ReadGuard() { if(epochs) epochs->exit(slot); }
+};
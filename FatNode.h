@@ -0,0 +1,19 @@
+// Modification slots shared by the fat-node trees
+
+#pragma once
+
+// LEFT and RIGHT are 0 and 1, so a comparison result picks the side directly.
+// BUSY marks a slot a writer has claimed but not yet filled.
+enum Mod {
+    LEFT, RIGHT, EMPTY, BUSY
+};
+
+template<typename Node>
+struct Modification {
+
+    int version;
+    Mod type;
+    Node* node;
+
+    Modification() : version(0), type(EMPTY), node(nullptr) {}
+};
@@ -0,0 +1,442 @@
+// Fully persistent binary search tree with an order-maintained version tree
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <numeric>
+#include <vector>
+
+#include "Arena.h"
+#include "Epoch.h"
+#include "FatNode.h"
+#include "Stats.h"
+#include "VersionTable.h"
+
+// A node has one modification slot. A writer claims it with a compare-and-swap
+// from EMPTY to BUSY before filling it in; see FullTree. version is the
+// version that created the node.
+template<typename Key>
+struct FullNode {
+
+    struct Slot {
+        int version;
+        std::atomic<Mod> type;
+        FullNode* node;
+
+        Slot() : version(0), type(EMPTY), node(nullptr) {}
+    };
+
+    Key key;
+    int version;
+    FullNode *left, *right;
+    Slot mod;
+
+    FullNode(const Key& key, int version) : key(key), version(version), left(nullptr), right(nullptr) {}
+};
+
+// Version tree kept as an Euler tour in an order-maintenance list: every
+// version owns an enter and an exit token, and a child's pair is spliced in
+// right after its parent's enter token. x is an ancestor of y exactly when
+// y's tokens sit between x's, which is two label comparisons.
+//
+// Splicing is serialized by a mutex, which is held only for the splice
+// itself. This is the one global lock on the write path: a splice touches
+// labels that neighbouring versions' splices may relabel, and it costs a few
+// pointer writes against the path copy that runs outside the lock. isAncestor() takes no lock: relabeling is bracketed by a sequence
+// counter, and a reader that overlaps one simply reads the labels again.
+struct OrderTree {
+
+    struct Token {
+        std::atomic<uint64_t> label;
+        int prev, next;
+    };
+
+    static constexpr uint64_t Universe = 1ULL << 62;
+    static constexpr double Density = 1.3;
+
+    static const int ChunkBits = 12;
+    static const int MaxChunks = 1 << 15;
+
+    std::atomic<Token*> chunks[MaxChunks];
+    std::atomic<uint64_t> sequence;
+    std::mutex lock;
+
+    OrderTree() : sequence(0) {
+        for(auto& chunk : chunks) chunk.store(nullptr, std::memory_order_relaxed);
+        reset();
+    }
+
+    OrderTree(const OrderTree&) = delete;
+    OrderTree& operator=(const OrderTree&) = delete;
+
+    ~OrderTree() {
+        for(auto& chunk : chunks) delete[] chunk.load();
+    }
+
+    Token& token(int t) const {
+        return chunks[t >> ChunkBits].load(std::memory_order_acquire)[t & ((1 << ChunkBits) - 1)];
+    }
+
+    uint64_t label(int t) const {
+        return token(t).label.load(std::memory_order_relaxed);
+    }
+
+    // Makes room for tokens up to t. Called with the lock held, or with no
+    // other thread about.
+    void reserve(int t) {
+        for(int c = 0; c <= t >> ChunkBits; c++) {
+            if(chunks[c].load(std::memory_order_relaxed) == nullptr) chunks[c].store(new Token[1 << ChunkBits], std::memory_order_release);
+        }
+    }
+
+    size_t bytes() const {
+        size_t count = 0;
+        for(auto& chunk : chunks) count += chunk.load(std::memory_order_relaxed) != nullptr;
+        return count * (sizeof(Token) << ChunkBits);
+    }
+
+    // Back to the single root version 0.
+    void reset() {
+        reserve(1);
+        token(0).label.store(0);
+        token(0).prev = -1;
+        token(0).next = 1;
+        token(1).label.store(Universe - 1);
+        token(1).prev = 0;
+        token(1).next = -1;
+    }
+
+    // Spreads out the smallest aligned label range around a that is sparse
+    // enough, so that a has room for a successor (Bender et al.).
+    void relabel(int a) {
+
+        int first = a, last = a, count = 1;
+        uint64_t range = 1, base = 0;
+
+        for(int level = 1; ; level++) {
+            range <<= 1;
+            base = label(a) & ~(range - 1);
+            while(token(first).prev != -1 && label(token(first).prev) >= base) {
+                first = token(first).prev;
+                count++;
+            }
+            while(token(last).next != -1 && label(token(last).next) - base < range) {
+                last = token(last).next;
+                count++;
+            }
+            if(count < range / std::pow(Density, level) || range == Universe) break;
+        }
+
+        uint64_t gap = range / count;
+        uint64_t seq = sequence.load(std::memory_order_relaxed);
+        sequence.store(seq + 1, std::memory_order_relaxed);
+        for(int t = first, i = 0; ; t = token(t).next, i++) {
+            token(t).label.store(base + i * gap, std::memory_order_release);
+            if(t == last) break;
+        }
+        sequence.store(seq + 2, std::memory_order_release);
+    }
+
+    void insertAfter(int a, int t) {
+        int b = token(a).next;
+        if(label(b) - label(a) < 2) relabel(a);
+        token(t).label.store(label(a) + (label(b) - label(a)) / 2, std::memory_order_relaxed);
+        token(t).prev = a;
+        token(t).next = b;
+        token(a).next = t;
+        token(b).prev = t;
+    }
+
+    void insert(int x, int y) {
+        std::lock_guard<std::mutex> guard(lock);
+        reserve(2 * y + 1);
+        insertAfter(2 * x, 2 * y);
+        insertAfter(2 * y, 2 * y + 1);
+    }
+
+    // Rebuilds the list from the enter and exit labels of count versions, as a
+    // snapshot stores them.
+    template<typename Labels>
+    void restore(const Labels* labels, int count) {
+        reserve(2 * count - 1);
+        std::vector<int> order(2 * count);
+        for(int version = 0; version < count; version++) {
+            token(2 * version).label.store(labels[version].enter);
+            token(2 * version + 1).label.store(labels[version].exit);
+        }
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](int a, int b) { return label(a) < label(b); });
+        token(order[0]).prev = -1;
+        token(order.back()).next = -1;
+        for(int i = 0; i + 1 < 2 * count; i++) {
+            token(order[i]).next = order[i + 1];
+            token(order[i + 1]).prev = order[i];
+        }
+    }
+
+    // A relabeled label is stored with release after the counter went odd,
+    // so reading one with acquire guarantees the second counter load differs.
+    bool isAncestor(int x, int y) const {
+        auto read = [&](int t) { return token(t).label.load(std::memory_order_acquire); };
+        for(;;) {
+            uint64_t seq = sequence.load(std::memory_order_acquire);
+            bool ancestor = read(2 * x) <= read(2 * y) && read(2 * y + 1) <= read(2 * x + 1);
+            if(!(seq & 1) && sequence.load(std::memory_order_relaxed) == seq) return ancestor;
+        }
+    }
+};
+
+// Any number of threads may derive new versions at once, from the same or
+// different parents, while others query. A new version takes the next id
+// from the version table and its place in the version tree under the order
+// list's short lock; the path copy itself runs in parallel. Writers contend
+// only on a node's single mod slot, which is claimed with a compare-and-swap
+// (EMPTY -> BUSY) and then published as LEFT or RIGHT with a release store:
+// the loser copies the node, as it would if the slot were full.
+//
+// A Batch is a version under construction: begin() derives it, any number
+// of inserts and erases build it, and commit() publishes it. Nodes the batch
+// created, and the slot it claimed on a node, are changed in place, so each
+// node is copied at most once per batch. A batch belongs to one writer.
+//
+// Keys are ordered by Compare, a function object kept in the tree as in
+// PartialTree. Nodes live in a ConcurrentArena, so keys must be trivially
+// destructible.
+template<typename Key, typename Compare = std::less<Key>>
+struct FullTree {
+
+    using Node = FullNode<Key>;
+
+    Compare compare;
+    VersionTable<Node*> root;
+    ConcurrentArena<Node> nodes;
+    EpochManager epochs;
+    OrderTree versions;
+    TreeStats stats;
+
+    FullTree(const Compare& compare = Compare()) : compare(compare) { root.append(nullptr); }
+
+    // Highest version id handed out so far.
+    int lastVersion() const {
+        return root.size() - 1;
+    }
+
+    struct Batch {
+        int version;
+        int parent;
+        Node* root;
+    };
+
+    Node* createNode(const Key& key, int version) {
+        TREE_COUNT(stats, NODES, 1);
+        return nodes.create(key, version);
+    }
+
+    Node* clone(Node* node, int version) {
+        TREE_COUNT(stats, CLONES, 1);
+        auto newNode = createNode(node->key, version);
+        newNode->left = getLeft(node, version);
+        newNode->right = getRight(node, version);
+        return newNode;
+    }
+
+    bool isAncestor(int x, int y) {
+        TREE_COUNT(stats, ANCESTOR_CHECKS, 1);
+        return versions.isAncestor(x, y);
+    }
+
+    Node* getChild(Node* node, Mod type, int version) {
+        if(node->mod.type.load(std::memory_order_acquire) == type && isAncestor(node->mod.version, version)) return node->mod.node;
+        return type == LEFT ? node->left : node->right;
+    }
+
+    Node* getLeft(Node* node, int version) {
+        return getChild(node, LEFT, version);
+    }
+
+    Node* getRight(Node* node, int version) {
+        return getChild(node, RIGHT, version);
+    }
+
+    bool claim(Node* node, Mod type, Node* child, int version) {
+        Mod empty = EMPTY;
+        if(!node->mod.type.compare_exchange_strong(empty, BUSY, std::memory_order_acquire)) {
+            TREE_COUNT(stats, SLOTS_OVERFLOWED, 1);
+            return false;
+        }
+        node->mod.node = child;
+        node->mod.version = version;
+        node->mod.type.store(type, std::memory_order_release);
+        TREE_COUNT(stats, SLOTS_FILLED, 1);
+        return true;
+    }
+
+    Node* setLeft(Node* node, Node* left, int version) {
+
+        if(getLeft(node, version) == left) return node;
+        if(node->version == version) {
+            node->left = left;
+            return node;
+        }
+        if(node->mod.type.load(std::memory_order_acquire) == LEFT && node->mod.version == version) {
+            node->mod.node = left;
+            return node;
+        }
+        if(claim(node, LEFT, left, version)) return node;
+
+        auto newNode = clone(node, version);
+        newNode->left = left;
+        return newNode;
+    }
+
+    Node* setRight(Node* node, Node* right, int version) {
+
+        if(getRight(node, version) == right) return node;
+        if(node->version == version) {
+            node->right = right;
+            return node;
+        }
+        if(node->mod.type.load(std::memory_order_acquire) == RIGHT && node->mod.version == version) {
+            node->mod.node = right;
+            return node;
+        }
+        if(claim(node, RIGHT, right, version)) return node;
+
+        auto newNode = clone(node, version);
+        newNode->right = right;
+        return newNode;
+    }
+
+    Node* insert(Node* node, const Key& key, int version) {
+
+        if(!node) return createNode(key, version);
+
+        if(compare(key, node->key)) {
+            auto left = insert(getLeft(node, version), key, version);
+            return setLeft(node, left, version);
+        }
+
+        if(compare(node->key, key)) {
+            auto right = insert(getRight(node, version), key, version);
+            return setRight(node, right, version);
+        }
+
+        return node;
+    }
+
+    Node* erase(Node* node, const Key& key, int version) {
+
+        if(!node) return nullptr;
+
+        if(compare(key, node->key)) {
+            auto left = erase(getLeft(node, version), key, version);
+            return setLeft(node, left, version);
+        }
+
+        if(compare(node->key, key)) {
+            auto right = erase(getRight(node, version), key, version);
+            return setRight(node, right, version);
+        }
+
+        if(!getLeft(node, version)) return getRight(node, version);
+        if(!getRight(node, version)) return getLeft(node, version);
+
+        auto succ = getRight(node, version);
+        while(getLeft(succ, version)) succ = getLeft(succ, version);
+
+        auto newNode = createNode(succ->key, version);
+        newNode->left = getLeft(node, version);
+
+        auto right = erase(getRight(node, version), succ->key, version);
+        newNode->right = right;
+
+        return newNode;
+    }
+
+    bool search(Node* node, const Key& key, int version) {
+        int visited = 0;
+        bool found = false;
+        while(node) {
+            visited++;
+            bool right = compare(node->key, key);
+            if(!right && !compare(key, node->key)) {
+                found = true;
+                break;
+            }
+            node = getChild(node, Mod(right), version);
+        }
+        TREE_COUNT(stats, FINDS, 1);
+        TREE_COUNT(stats, PATH_LENGTH, visited);
+        return found;
+    }
+
+    bool find(const Key& key, int version) {
+        return search(root[version], key, version);
+    }
+
+    // Sees the batch's own updates.
+    bool find(const Batch& batch, const Key& key) {
+        return search(batch.root, key, batch.version);
+    }
+
+    // Derives a new version from the given one. An unknown parent throws
+    // before an id is reserved or the version list is touched.
+    Batch begin(int version) {
+        Node* parent = root[version];
+        int created = root.reserve();
+        versions.insert(version, created);
+        return {created, version, parent};
+    }
+
+    void insert(Batch& batch, const Key& key) {
+        batch.root = insert(batch.root, key, batch.version);
+    }
+
+    void erase(Batch& batch, const Key& key) {
+        batch.root = erase(batch.root, key, batch.version);
+    }
+
+    // Publishes the batch's version and returns its id.
+    int commit(Batch& batch) {
+        root.publish(batch.version, batch.root);
+        TREE_COUNT(stats, VERSIONS, 1);
+        return batch.version;
+    }
+
+    // The new version's id, which the caller gets back.
+    int insert(const Key& key, int version) {
+        auto batch = begin(version);
+        insert(batch, key);
+        return commit(batch);
+    }
+
+    int erase(const Key& key, int version) {
+        auto batch = begin(version);
+        erase(batch, key);
+        return commit(batch);
+    }
+
+    // Readers hold a guard while they walk a version; nodes stay valid until it is dropped.
+    ReadGuard pin() {
+        return ReadGuard(epochs);
+    }
+
+    // Drops every version. The old nodes are freed once the readers inside
+    // have left; no writer may be running.
+    void clear() {
+        auto chunks = root.detach();
+        root.append(nullptr);
+        versions.reset();
+        auto slabs = nodes.detach();
+        epochs.retire([slabs, chunks]() {
+            ConcurrentArena<Node>::free(slabs);
+            VersionTable<Node*>::free(chunks);
+        });
+        epochs.collect();
+    }
+};
@@ -0,0 +1,180 @@
+// Append-only operation journal for the persistent trees
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// JOURNAL_BATCH heads the updates of a batch, whose number is its key.
+enum JournalOp : uint32_t {
+    JOURNAL_INSERT = 1, JOURNAL_ERASE = 2, JOURNAL_BATCH = 3
+};
+
+// One update: the version it created, the version it was derived from, the
+// key and the operation, followed by a CRC-32 of those 16 bytes.
+struct JournalRecord {
+    int32_t version;
+    int32_t parent;
+    int32_t key;
+    uint32_t op;
+    uint32_t checksum;
+};
+
+inline uint32_t crc32(const void* data, size_t size) {
+
+    struct Table {
+        uint32_t entries[256];
+        Table() {
+            for(uint32_t i = 0; i < 256; i++) {
+                uint32_t c = i;
+                for(int j = 0; j < 8; j++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                entries[i] = c;
+            }
+        }
+    };
+    static const Table table;
+
+    uint32_t c = 0xFFFFFFFFu;
+    auto bytes = static_cast<const uint8_t*>(data);
+    for(size_t i = 0; i < size; i++) c = table.entries[(c ^ bytes[i]) & 0xFF] ^ (c >> 8);
+    return c ^ 0xFFFFFFFFu;
+}
+
+inline uint32_t checksum(const JournalRecord& record) {
+    return crc32(&record, sizeof(JournalRecord) - sizeof(uint32_t));
+}
+
+// The updates that made one version: a single update, or a whole batch.
+struct JournalEntry {
+    int version;
+    int parent;
+    std::vector<std::pair<JournalOp, int>> updates;
+};
+
+// Records are buffered and written with one write() and one fdatasync() per
+// group (group commit): a record is durable once commit() has returned,
+// which happens by itself every groupSize records.
+struct Journal {
+
+    int fd;
+    size_t groupSize;
+    std::vector<JournalRecord> pending;
+    std::mutex lock;
+
+    Journal(const std::string& path, size_t groupSize = 64) : groupSize(groupSize) {
+        fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if(fd < 0) throw std::runtime_error("cannot open journal " + path);
+    }
+
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    // Flushes what is left as a best effort: a destructor cannot report a
+    // failed write. Callers that need to know call commit() first.
+    ~Journal() {
+        try {
+            commit();
+        } catch(const std::exception&) {}
+        close(fd);
+    }
+
+    void push(JournalOp op, int key, int version, int parent) {
+        JournalRecord record = {version, parent, key, op, 0};
+        record.checksum = checksum(record);
+        pending.push_back(record);
+    }
+
+    void append(JournalOp op, int key, int version, int parent) {
+        std::lock_guard<std::mutex> guard(lock);
+        push(op, key, version, parent);
+        if(pending.size() >= groupSize) flush();
+    }
+
+    // Logs the updates of a batch in one run behind a JOURNAL_BATCH record,
+    // so that replay can tell a batch a crash cut short and drop it whole.
+    void append(const std::vector<std::pair<JournalOp, int>>& updates, int version, int parent) {
+        std::lock_guard<std::mutex> guard(lock);
+        push(JOURNAL_BATCH, updates.size(), version, parent);
+        for(auto& update : updates) push(update.first, update.second, version, parent);
+        if(pending.size() >= groupSize) flush();
+    }
+
+    void commit() {
+        std::lock_guard<std::mutex> guard(lock);
+        flush();
+    }
+
+    // Drops everything logged so far, once a snapshot covers it.
+    void truncate() {
+        std::lock_guard<std::mutex> guard(lock);
+        flush();
+        if(ftruncate(fd, 0) != 0 || fdatasync(fd) != 0) throw std::runtime_error("journal truncate failed");
+    }
+
+    void flush() {
+        if(pending.empty()) return;
+        size_t size = pending.size() * sizeof(JournalRecord);
+        if(write(fd, pending.data(), size) != (ssize_t)size || fdatasync(fd) != 0) {
+            throw std::runtime_error("journal write failed");
+        }
+        pending.clear();
+    }
+
+    // Reads the records of a journal in one go. Reading stops at the first
+    // torn or corrupt record, which is where a crash cut the log short.
+    static std::vector<JournalRecord> read(const std::string& path) {
+
+        std::vector<JournalRecord> records;
+
+        int fd = open(path.c_str(), O_RDONLY);
+        if(fd < 0) return records;
+
+        off_t size = lseek(fd, 0, SEEK_END);
+        lseek(fd, 0, SEEK_SET);
+        records.resize(size / sizeof(JournalRecord));
+        ssize_t got = ::read(fd, records.data(), records.size() * sizeof(JournalRecord));
+        close(fd);
+        records.resize(got > 0 ? got / sizeof(JournalRecord) : 0);
+
+        for(size_t i = 0; i < records.size(); i++) {
+            if(records[i].checksum != checksum(records[i])) {
+                records.resize(i);
+                break;
+            }
+        }
+
+        return records;
+    }
+
+    // Groups records into the versions they made, in log order, up to the
+    // first batch that is incomplete.
+    static std::vector<JournalEntry> entries(const std::vector<JournalRecord>& records) {
+
+        std::vector<JournalEntry> entries;
+
+        for(size_t i = 0; i < records.size(); ) {
+            auto& head = records[i];
+            JournalEntry entry = {head.version, head.parent, {}};
+            if(head.op != JOURNAL_BATCH) {
+                entry.updates.emplace_back((JournalOp)head.op, head.key);
+                entries.push_back(entry);
+                i++;
+                continue;
+            }
+            size_t count = head.key;
+            if(i + 1 + count > records.size()) break;
+            for(size_t j = i + 1; j <= i + count; j++) entry.updates.emplace_back((JournalOp)records[j].op, records[j].key);
+            entries.push_back(entry);
+            i += 1 + count;
+        }
+
+        return entries;
+    }
+};
@@ -1,7 +1,5 @@
 // Partially Persistent Red-Black Tree
 
-#include <memory>
-#include <map>
 #include <iostream>
 #include <vector>
 #include <numeric>
@@ -9,314 +7,140 @@
 #include <chrono>
 #include <algorithm>
 
+#include "RedBlackTree.h"
+
 using namespace std;
 
 mt19937 rng(chrono::steady_clock::now().time_since_epoch().count());
 
-enum Color {
-    RED, BLACK
-};
-
-enum ModType {
-    EMPTY, LEFT, RIGHT
-};
-
-struct Modification;
-struct Node;
-struct RedBlackTree;
-
-struct Modification {
-
-    ModType type;
-    int version;
-    shared_ptr<Node> node;
-
-    Modification() : 
-        type(EMPTY),
-        version(-1),
-        node(nullptr) {}
-};
-
-struct Node {
-
-    int key;
-    Color color;
-    shared_ptr<Node> left, right;
-    shared_ptr<Node> parent;
-    shared_ptr<Modification> mod;
-
-    Node(int key, shared_ptr<Node> parent = nullptr) :
-        key(key), 
-        color(RED),
-        left(nullptr),
-        right(nullptr),
-        parent(parent),
-        mod(make_shared<Modification>()) {}
-
-    shared_ptr<Node> copy() {
-
-        auto node = make_shared<Node>(key, parent);
-        node->color = color;
-        node->left = (mod->type == LEFT) ? mod->node : left;
-        node->right = (mod->type == RIGHT) ? mod->node : right;
-
-        return node;
-    }
-
-    shared_ptr<Node> getLeft(int version) {
-        if(mod->type == LEFT && mod->version <= version) return mod->node;
-        return left;
-    }
-
-    shared_ptr<Node> getRight(int version) {
-        if(mod->type == RIGHT && mod->version <= version) return mod->node;
-        return right;
-    }
-};
-
-struct RedBlackTree {
-    
-    map<int, shared_ptr<Node>> root;
-    int latestVersion;
-
-    RedBlackTree() : latestVersion(0) {
-        root[0] = nullptr;
-    }
-
-    shared_ptr<Node> getRoot(int version) {
-        auto it = --(root.upper_bound(version));
-        return it->second;
-    }
-
-    shared_ptr<Node> getRoot() {
-        auto it = root.rbegin();
-        return it->second;
-    }
-
-    shared_ptr<Node> getLeft(const shared_ptr<Node>& node, int version) {
-        return node == nullptr ? nullptr : node->getLeft(version);
-    }
+void testInsert() {
 
-    shared_ptr<Node> getRight(const shared_ptr<Node>& node, int version) {
-        return node == nullptr ? nullptr : node->getRight(version);
-    }
+    RedBlackTree<int> tree;
 
-    shared_ptr<Node> getLeft(const shared_ptr<Node>& node) {
-        return getLeft(node, latestVersion);
-    }
+    vector<int> keys(10);
+    iota(keys.begin(), keys.end(), 1);
+    shuffle(keys.begin(), keys.end(), rng);
 
-    shared_ptr<Node> getRight(const shared_ptr<Node>& node) {
-        return getRight(node, latestVersion);
+    for(auto key : keys) {
+        cout << "Inserting " << key << endl;
+        tree.insert(key);
     }
 
-    void setLeft(shared_ptr<Node>&, shared_ptr<Node>);
-    void setRight(shared_ptr<Node>&, shared_ptr<Node>);
-    void leftRotate(shared_ptr<Node>&);
-    void rightRotate(shared_ptr<Node>&);
-    void fixInsert(shared_ptr<Node>);
-
-    void insert(int key) {
-
-        latestVersion++;
-
-        if(getRoot() == nullptr) {
-            root[latestVersion] = make_shared<Node>(key);
-            getRoot()->color = BLACK;
-            return;
-        }
-
-        shared_ptr<Node> node = getRoot(), parent = nullptr;
-
-        while(node != nullptr) {
-            parent = node;
-            if(key < node->key) node = getLeft(node);
-            else node = getRight(node);
+    for(int i = 1; i <= 10; i++) {
+        cout << "Version " << i << ": ";
+        for(int j = 1; j <= 10; j++) {
+            cout << tree.count(j, i) << " ";
         }
-
-        node = make_shared<Node>(key, parent);
-        if(key < parent->key) setLeft(parent, node);
-        else setRight(parent, node);
-
-        // fixInsert(node);
+        cout << (tree.isValid(i) ? "valid" : "INVALID") << " depth " << tree.depth(i);
+        cout << endl;
     }
+}
 
-    bool count(int key, int version) {
-
-        shared_ptr<Node> node = getRoot(version);
-
-        while(node != nullptr) {
-            if(node->key == key) return true;
-            if(key < node->key) node = getLeft(node, version);
-            else node = getRight(node, version);
-        }
+void testErase() {
 
-        return false;
-    }
-};
+    RedBlackTree<int> tree;
 
-void RedBlackTree::setLeft(shared_ptr<Node> &node, shared_ptr<Node> left) {
+    vector<int> keys(10);
+    iota(keys.begin(), keys.end(), 1);
+    for(auto key : keys) tree.insert(key);
 
-    if(node->mod->type == EMPTY || (node->mod->type == LEFT && node->mod->version == latestVersion)) {
-        node->mod->type = LEFT;
-        node->mod->version = latestVersion;
-        node->mod->node = left;
-        if(left != nullptr) left->parent = node;
-        return;
+    shuffle(keys.begin(), keys.end(), rng);
+    for(auto key : keys) {
+        cout << "Erasing " << key << endl;
+        tree.erase(key);
     }
 
-    auto newNode = node->copy();
-    newNode->left = left;
-    if(left != nullptr) left->parent = newNode;
-    if(newNode->right != nullptr) newNode->right->parent = newNode;
-
-    if(node->parent == nullptr) {
-        root[latestVersion] = newNode;
-        node = newNode;
-        return;
+    for(int i = 10; i <= 20; i++) {
+        cout << "Version " << i << ": ";
+        for(int j = 1; j <= 10; j++) {
+            cout << tree.count(j, i) << " ";
+        }
+        cout << (tree.isValid(i) ? "valid" : "INVALID") << " depth " << tree.depth(i);
+        cout << endl;
     }
-
-    if(getLeft(node->parent) == node) setLeft(node->parent, newNode);
-    else setRight(node->parent, newNode);
-
-    newNode->parent = node->parent;
-    node = newNode;
 }
 
-void RedBlackTree::setRight(shared_ptr<Node> &node, shared_ptr<Node> right) {
-
-    if(node->mod->type == EMPTY || (node->mod->type == RIGHT && node->mod->version == latestVersion)) {
-        node->mod->type = RIGHT;
-        node->mod->version = latestVersion;
-        node->mod->node = right;
-        if(right != nullptr) right->parent = node;
-        return;
-    }
-
-    auto newNode = node->copy();
-    newNode->right = right;
-    if(right != nullptr) right->parent = newNode;
-    if(newNode->left != nullptr) newNode->left->parent = newNode;
+void benchmarkSequential(int n) {
 
-    if(node->parent == nullptr) {
-        root[latestVersion] = newNode;
-        node = newNode;
-        return;
-    }
+    cout << "Sequential keys 1.." << n << endl;
 
-    if(getLeft(node->parent) == node) setLeft(newNode->parent, newNode);
-    else setRight(newNode->parent, newNode);
+    for(bool balanced : {false, true}) {
 
-    newNode->parent = node->parent;
-    node = newNode;
-}
+        RedBlackTree<int> tree(balanced);
 
-void RedBlackTree::leftRotate(shared_ptr<Node> &node) {
+        auto start = chrono::steady_clock::now();
+        for(int key = 1; key <= n; key++) tree.insert(key);
+        auto inserted = chrono::steady_clock::now();
 
-    if(node == nullptr || getRight(node) == nullptr) return;
+        int found = 0;
+        for(int version = 1; version <= n; version += 7) {
+            for(int key = 1; key <= n; key += 13) found += tree.count(key, version);
+        }
+        auto queried = chrono::steady_clock::now();
 
-    auto right = getRight(node);
-    
-    setRight(node, getLeft(right));
+        int maxDepth = 0;
+        bool valid = true;
+        for(int version = 1; version <= n; version += n / 10) {
+            maxDepth = max(maxDepth, tree.depth(version));
+            valid = valid && tree.isValid(version);
+        }
+        maxDepth = max(maxDepth, tree.depth(n));
 
-    if(node->parent == nullptr) {
-        root[latestVersion] = right;
-        right->parent = nullptr;
-    } else if(getLeft(node->parent) == node) {
-        setLeft(node->parent, right);
-    } else {
-        setRight(node->parent, right);
+        cout << (balanced ? "red-black" : "unbalanced") << ": "
+             << "insert " << chrono::duration<double, milli>(inserted - start).count() << " ms, "
+             << "queries " << chrono::duration<double, milli>(queried - inserted).count() << " ms (" << found << " hits), "
+             << "max depth " << maxDepth;
+        if(balanced) cout << ", " << (valid ? "valid" : "INVALID");
+        cout << endl;
     }
-
-    setLeft(right, node);
 }
 
-void RedBlackTree::rightRotate(shared_ptr<Node> &node) {
+// Keeps n keys in the tree and replaces one per pair of updates, reporting
+// how many nodes each update allocates on average.
+template<int K>
+void benchmarkChurn(int n, int updates) {
 
-    if(node == nullptr || getLeft(node) == nullptr) return;
+    RedBlackTree<int, less<int>, Arena, K> tree;
+    mt19937 gen(1);
 
-    auto left = node->getLeft(latestVersion);
+    vector<int> keys(n);
+    iota(keys.begin(), keys.end(), 0);
+    shuffle(keys.begin(), keys.end(), gen);
+    for(int key : keys) tree.insert(key);
 
-    setLeft(node, getRight(left));
+    size_t before = tree.nodes.size();
+    auto start = chrono::steady_clock::now();
 
-    if(node->parent == nullptr) {
-        root[latestVersion] = left;
-        left->parent = nullptr;
-    } else if(getLeft(node->parent) == node) {
-        setLeft(node->parent, left);
-    } else {
-        setRight(node->parent, left);
+    int next = n;
+    for(int i = 0; i < updates; i += 2) {
+        int j = gen() % n;
+        tree.erase(keys[j]);
+        keys[j] = next++;
+        tree.insert(keys[j]);
     }
 
-    setRight(left, node);
-}
-
-void RedBlackTree::fixInsert(shared_ptr<Node> node) {
-
-    while(node->parent != nullptr && node->parent->color == RED) {
-
-        if(node->parent == getLeft(node->parent->parent)) {
-            auto uncle = getRight(node->parent->parent);
-            if(uncle != nullptr && uncle->color == RED) {
-                node->parent->color = BLACK;
-                uncle->color = BLACK;
-                node->parent->parent->color = RED;
-                node = node->parent->parent;
-            } else {
-                if(node == getRight(node->parent)) {
-                    node = node->parent;
-                    leftRotate(node);
-                }
-                node->parent->color = BLACK;
-                node->parent->parent->color = RED;
-                rightRotate(node->parent->parent);
-            }
-        } else {
-            auto uncle = getLeft(node->parent->parent);
-            if(uncle != nullptr && uncle->color == RED) {
-                node->parent->color = BLACK;
-                uncle->color = BLACK;
-                node->parent->parent->color = RED;
-                node = node->parent->parent;
-            } else {
-                if(node == getLeft(node->parent)) {
-                    node = node->parent;
-                    rightRotate(node);
-                }
-                node->parent->color = BLACK;
-                node->parent->parent->color = RED;
-                leftRotate(node->parent->parent);
-            }
-        }
-    }
+    auto end = chrono::steady_clock::now();
 
-    getRoot()->color = BLACK;
+    cout << "k=" << K << ": churn on " << n << " keys: " << updates << " updates in "
+         << chrono::duration<double, milli>(end - start).count() << " ms, "
+         << 1.0 * (tree.nodes.size() - before) / updates << " nodes per update, "
+         << (tree.isValid(tree.latestVersion) ? "valid" : "INVALID") << endl;
 }
 
-void testInsert() {
-
-    RedBlackTree tree;
-
-    vector<int> keys(10);
-    iota(keys.begin(), keys.end(), 1);
-    shuffle(keys.begin(), keys.end(), rng);
-
-    for(auto key : keys) {
-        cout << "Inserting " << key << endl;
-        tree.insert(key);
-    }
+int main(int argc, char** argv) {
 
-    for(int i = 1; i <= 10; i++) {
-        cout << "Version " << i << ": ";
-        for(int j = 1; j <= 10; j++) {
-            cout << tree.count(j, i) << " ";
-        }
-        cout << endl;
+    if(argc > 1 && string(argv[1]) == "bench") {
+        int n = argc > 2 ? stoi(argv[2]) : 5000;
+        benchmarkSequential(n);
+        benchmarkChurn<1>(n, 20 * n);
+        benchmarkChurn<2>(n, 20 * n);
+        benchmarkChurn<3>(n, 20 * n);
+        benchmarkChurn<4>(n, 20 * n);
+        return 0;
     }
-}
-
-int main() {
 
     testInsert();
+    testErase();
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,524 @@
+// Partially persistent binary search tree on fat nodes
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <functional>
+#include <stdexcept>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Arena.h"
+#include "Epoch.h"
+#include "FatNode.h"
+#include "Stats.h"
+#include "VersionTable.h"
+
+// A fat node with K modification slots, filled in version order. Only once
+// all K are taken does a change copy the node. version is the version that
+// created the node. Updates always come down from
+// the root, so the new copy is handed back to the parent along the recursion
+// (which plays the part of the back pointers in Driscoll et al.), and the
+// parent has K slots of its own to absorb it: copies cascade amortized O(1).
+// A slot is filled before used is bumped with a release store, so a reader
+// walking the node at the same time only ever sees complete slots.
+template<typename Key, int K>
+struct PartialNode {
+
+    Key key;
+    int version;
+    std::atomic<int> used;
+    PartialNode *left, *right;
+    Modification<PartialNode> mods[K];
+
+    PartialNode(const Key& key, int version) : key(key), version(version), used(0), left(nullptr), right(nullptr) {}
+};
+
+// Keys are ordered by Compare, a function object kept in the tree, so it may
+// carry state (the segment order of a sweep depends on the sweep position)
+// and its calls are inlined. Nodes come from Alloc, an arena with the
+// interface of Arena. The descent turns the comparison straight into the
+// side to follow, so for integer keys it compiles to flag arithmetic rather
+// than a branch per level.
+//
+// One writer thread calls insert/erase while any number of reader threads
+// run find(key, version) on versions up to latestVersion(). Readers take no
+// locks: roots come out of the version table and slots are published with
+// release stores, so a reader sees a version only once it is complete.
+// currentVersion and getRoot() belong to the writer.
+//
+// Between begin() and commit(), any number of inserts and erases build one
+// new version together. A node created by the version, or a slot it already
+// filled for the same side, is changed in place, so however many of them
+// touch a node it is copied at most once.
+template<typename Key, typename Compare = std::less<Key>, template<typename> class Alloc = Arena, int K = 1>
+struct PartialTree {
+
+    using Node = PartialNode<Key, K>;
+
+    Compare compare;
+    int currentVersion;
+    int retiredBelow;
+    std::atomic<int> latest;
+    VersionTable<Node*> root;
+    Alloc<Node> nodes;
+    EpochManager epochs;
+    TreeStats stats;
+    Node* working;
+    bool batching;
+
+    PartialTree(const Compare& compare = Compare()) :
+        compare(compare), currentVersion(0), retiredBelow(0), latest(0), working(nullptr), batching(false) {
+        root.append(nullptr);
+    }
+
+    // Newest version whose root has been published.
+    int latestVersion() const {
+        return latest.load(std::memory_order_acquire);
+    }
+
+    Node* createNode(const Key& key) {
+        TREE_COUNT(stats, NODES, 1);
+        return nodes.create(key, currentVersion);
+    }
+
+    Node* clone(Node* node) {
+        TREE_COUNT(stats, CLONES, 1);
+        auto newNode = createNode(node->key);
+        newNode->left = getLeft(node);
+        newNode->right = getRight(node);
+        return newNode;
+    }
+
+    // The root of the version being built while a batch is open.
+    Node* getRoot() {
+        return batching ? working : root[currentVersion];
+    }
+
+    Node* getChild(Node* node, Mod type, int version) {
+        for(int i = node->used.load(std::memory_order_acquire) - 1; i >= 0; i--) {
+            if(node->mods[i].type == type && node->mods[i].version <= version) return node->mods[i].node;
+        }
+        return type == LEFT ? node->left : node->right;
+    }
+
+    Node* getLeft(Node* node, int version) {
+        return getChild(node, LEFT, version);
+    }
+
+    Node* getRight(Node* node, int version) {
+        return getChild(node, RIGHT, version);
+    }
+
+    Node* getLeft(Node* node) {
+        return getChild(node, LEFT, currentVersion);
+    }
+
+    Node* getRight(Node* node) {
+        return getChild(node, RIGHT, currentVersion);
+    }
+
+    bool equal(const Key& a, const Key& b) {
+        return !compare(a, b) && !compare(b, a);
+    }
+
+    Node* setChild(Node* node, Mod type, Node* child) {
+
+        if(getChild(node, type, currentVersion) == child) return node;
+
+        // Neither the node nor the slot is visible to readers yet.
+        if(node->version == currentVersion) {
+            (type == LEFT ? node->left : node->right) = child;
+            return node;
+        }
+
+        int used = node->used.load(std::memory_order_relaxed);
+        for(int i = used - 1; i >= 0 && node->mods[i].version == currentVersion; i--) {
+            if(node->mods[i].type == type) {
+                node->mods[i].node = child;
+                return node;
+            }
+        }
+
+        if(used < K) {
+            node->mods[used].type = type;
+            node->mods[used].node = child;
+            node->mods[used].version = currentVersion;
+            node->used.store(used + 1, std::memory_order_release);
+            TREE_COUNT(stats, SLOTS_FILLED, 1);
+            return node;
+        }
+
+        TREE_COUNT(stats, SLOTS_OVERFLOWED, 1);
+        auto newNode = clone(node);
+        (type == LEFT ? newNode->left : newNode->right) = child;
+        return newNode;
+    }
+
+    Node* setLeft(Node* node, Node* left) {
+        return setChild(node, LEFT, left);
+    }
+
+    Node* setRight(Node* node, Node* right) {
+        return setChild(node, RIGHT, right);
+    }
+
+    Node* insertKey(Node* node, const Key& key) {
+
+        if(!node) return createNode(key);
+
+        if(compare(key, node->key)) {
+            auto left = insertKey(getLeft(node), key);
+            return setLeft(node, left);
+        }
+
+        if(compare(node->key, key)) {
+            auto right = insertKey(getRight(node), key);
+            return setRight(node, right);
+        }
+
+        return node;
+    }
+
+    Node* deleteKey(Node* node, const Key& key) {
+
+        if(!node) return nullptr;
+
+        if(compare(key, node->key)) {
+            auto left = deleteKey(getLeft(node), key);
+            return setLeft(node, left);
+        }
+
+        if(compare(node->key, key)) {
+            auto right = deleteKey(getRight(node), key);
+            return setRight(node, right);
+        }
+
+        if(!getLeft(node)) return getRight(node);
+        if(!getRight(node)) return getLeft(node);
+
+        auto succ = getRight(node);
+        while(getLeft(succ)) succ = getLeft(succ);
+
+        auto newNode = createNode(succ->key);
+        newNode->left = getLeft(node);
+
+        auto right = deleteKey(getRight(node), succ->key);
+        newNode->right = right;
+
+        return newNode;
+    }
+
+    bool search(Node* node, const Key& key, int version) {
+        int visited = 0;
+        bool found = false;
+        while(node) {
+            visited++;
+            bool right = compare(node->key, key);
+            if(!right && !compare(key, node->key)) {
+                found = true;
+                break;
+            }
+            node = getChild(node, Mod(right), version);
+        }
+        TREE_COUNT(stats, FINDS, 1);
+        TREE_COUNT(stats, PATH_LENGTH, visited);
+        return found;
+    }
+
+    bool find(const Key& key, int version) {
+        return search(root[version], key, version);
+    }
+
+    // Sees the updates of an open batch.
+    bool find(const Key& key) {
+        return search(getRoot(), key, currentVersion);
+    }
+
+    // The greatest key in the version for which below holds, where below
+    // holds for a prefix of the key order; nullptr if it holds for none.
+    template<typename Predicate>
+    const Key* last(Predicate below, int version) {
+        return last(below, root[version], version);
+    }
+
+    // Sees the updates of an open batch.
+    template<typename Predicate>
+    const Key* last(Predicate below) {
+        return last(below, getRoot(), currentVersion);
+    }
+
+    template<typename Predicate>
+    const Key* last(Predicate below, Node* node, int version) {
+        const Key* found = nullptr;
+        int visited = 0;
+        while(node) {
+            visited++;
+            bool right = below(node->key);
+            if(right) found = &node->key;
+            node = getChild(node, Mod(right), version);
+        }
+        TREE_COUNT(stats, FINDS, 1);
+        TREE_COUNT(stats, PATH_LENGTH, visited);
+        return found;
+    }
+
+    // The least key in the version for which above holds, where above holds
+    // for a suffix of the key order; nullptr if it holds for none.
+    template<typename Predicate>
+    const Key* first(Predicate above, int version) {
+        return first(above, root[version], version);
+    }
+
+    // Sees the updates of an open batch.
+    template<typename Predicate>
+    const Key* first(Predicate above) {
+        return first(above, getRoot(), currentVersion);
+    }
+
+    template<typename Predicate>
+    const Key* first(Predicate above, Node* node, int version) {
+        const Key* found = nullptr;
+        int visited = 0;
+        while(node) {
+            visited++;
+            bool left = above(node->key);
+            if(left) found = &node->key;
+            node = getChild(node, Mod(!left), version);
+        }
+        TREE_COUNT(stats, FINDS, 1);
+        TREE_COUNT(stats, PATH_LENGTH, visited);
+        return found;
+    }
+
+    static void prefetch(Node* node) {
+        __builtin_prefetch(node);
+        if(sizeof(Node) > 64) __builtin_prefetch((char*)node + 64);
+    }
+
+    // Answers count (key, version) queries. Up to Group searches are in flight
+    // and advanced one level each in turn, with the next node of every search
+    // prefetched, so the cache misses of different queries overlap instead of
+    // each search stalling on its own pointer chase.
+    template<int Group = 16>
+    void find(const std::pair<Key, int>* queries, size_t count, bool* found) {
+
+        struct Search {
+            Node* node;
+            const Key* key;
+            int version;
+            size_t index;
+        };
+
+        Search group[Group];
+        size_t next = 0;
+        int active = 0;
+        size_t visited = 0;
+
+        auto start = [&](Search& search) {
+            auto& q = queries[next];
+            search = {root[q.second], &q.first, q.second, next++};
+            if(search.node) prefetch(search.node);
+        };
+
+        while(active < Group && next < count) start(group[active++]);
+
+        while(active > 0) {
+            for(int i = 0; i < active; ) {
+                Search& search = group[i];
+                Node* node = search.node;
+                bool done = true;
+                if(node) visited++;
+                if(!node) found[search.index] = false;
+                else if(equal(node->key, *search.key)) found[search.index] = true;
+                else {
+                    search.node = getChild(node, Mod(compare(node->key, *search.key)), search.version);
+                    if(search.node) prefetch(search.node);
+                    done = false;
+                }
+                if(!done) {
+                    i++;
+                } else if(next < count) {
+                    start(search);
+                    i++;
+                } else {
+                    search = group[--active];
+                }
+            }
+        }
+
+        TREE_COUNT(stats, FINDS, count);
+        TREE_COUNT(stats, PATH_LENGTH, visited);
+    }
+
+    // Opens a batch: the updates until commit() make up a single version.
+    void begin() {
+        working = getRoot();
+        currentVersion++;
+        batching = true;
+    }
+
+    // Publishes the version the open batch built.
+    void commit() {
+        root.append(working);
+        batching = false;
+        latest.store(currentVersion, std::memory_order_release);
+        TREE_COUNT(stats, VERSIONS, 1);
+    }
+
+    // A version of its own, unless a batch is open.
+    void insert(const Key& key) {
+        bool batched = batching;
+        if(!batched) begin();
+        working = insertKey(working, key);
+        if(!batched) commit();
+    }
+
+    void erase(const Key& key) {
+        bool batched = batching;
+        if(!batched) begin();
+        working = deleteKey(working, key);
+        if(!batched) commit();
+    }
+
+    // Readers hold a guard while they walk a version; nodes stay valid until it is dropped.
+    ReadGuard pin() {
+        return ReadGuard(epochs);
+    }
+
+    // Drops every version. The old nodes are freed once the readers inside have left.
+    void clear() {
+        auto chunks = root.detach();
+        root.append(nullptr);
+        currentVersion = 0;
+        latest.store(0, std::memory_order_release);
+        retiredBelow = 0;
+        auto slabs = nodes.detach();
+        epochs.retire([slabs, chunks]() {
+            Alloc<Node>::free(slabs);
+            VersionTable<Node*>::free(chunks);
+        });
+        epochs.collect();
+    }
+
+    // Drops the given versions; their nodes are reclaimed by the next
+    // collect(). The latest version always stays.
+    void retire(const std::vector<int>& versions) {
+        for(int version : versions) {
+            if(version != currentVersion) root.retract(version);
+        }
+    }
+
+    // Keeps only the newest count versions and reclaims the rest. The latest
+    // version always stays, so a count below one keeps just that. Throws,
+    // retiring nothing, inside an open batch; see collect().
+    void keepLast(int count) {
+        if(batching) throw std::logic_error("keepLast() inside an open batch");
+        for(; retiredBelow <= currentVersion - std::max(count, 1); retiredBelow++) root.retract(retiredBelow);
+        collect();
+    }
+
+    // First version after the given one at which the child on this side changes.
+    int nextChange(Node* node, Mod type, int version) {
+        for(int i = 0; i < node->used; i++) {
+            if(node->mods[i].type == type && node->mods[i].version > version) return node->mods[i].version;
+        }
+        return INT_MAX;
+    }
+
+    // Copies every node still reachable from a retained version into a fresh
+    // arena and retires the old one. A copy keeps only the modifications that
+    // some retained version reaching it can see, so mods that served retired
+    // versions alone are dropped, along with everything only they pointed to.
+    // The version of an open batch is not published yet, so its nodes would
+    // be left behind: collecting inside a batch throws instead.
+    void collect() {
+
+        if(batching) throw std::logic_error("collect() inside an open batch");
+
+        std::vector<int> kept;
+        for(int version = 0; version <= currentVersion; version++) {
+            if(root.contains(version)) kept.push_back(version);
+        }
+
+        // The retained versions reaching each node, as runs of indices into
+        // kept. A child only changes at the parent's mods, so a run splits
+        // into at most K + 1 runs on the way down.
+        std::unordered_map<Node*, std::vector<std::pair<int, int>>> reach;
+        std::vector<std::tuple<Node*, int, int>> stack;
+
+        for(int lo = 0, hi; lo < (int)kept.size(); lo = hi + 1) {
+            hi = lo;
+            while(hi + 1 < (int)kept.size() && root[kept[hi + 1]] == root[kept[lo]]) hi++;
+            if(root[kept[lo]]) stack.emplace_back(root[kept[lo]], lo, hi);
+        }
+
+        while(!stack.empty()) {
+            auto [node, lo, hi] = stack.back();
+            stack.pop_back();
+            reach[node].emplace_back(lo, hi);
+            for(Mod type : {LEFT, RIGHT}) {
+                for(int a = lo, b; a <= hi; a = b + 1) {
+                    int change = nextChange(node, type, kept[a]);
+                    b = std::min(hi, int(std::lower_bound(kept.begin(), kept.end(), change) - kept.begin()) - 1);
+                    Node* child = getChild(node, type, kept[a]);
+                    if(child) stack.emplace_back(child, a, b);
+                }
+            }
+        }
+
+        Alloc<Node> fresh;
+        std::unordered_map<Node*, Node*> moved;
+        moved[nullptr] = nullptr;
+        for(auto& entry : reach) moved[entry.first] = fresh.create(entry.first->key, entry.first->version);
+
+        for(auto& [node, runs] : reach) {
+
+            std::sort(runs.begin(), runs.end());
+            int first = kept[runs[0].first];
+
+            Node* copy = moved[node];
+            copy->left = moved[getChild(node, LEFT, first)];
+            copy->right = moved[getChild(node, RIGHT, first)];
+
+            for(int i = 0; i < node->used; i++) {
+                auto& mod = node->mods[i];
+                if(mod.version <= first) continue;
+                int lo = std::lower_bound(kept.begin(), kept.end(), mod.version) - kept.begin();
+                int hi = int(std::lower_bound(kept.begin(), kept.end(), nextChange(node, mod.type, mod.version)) - kept.begin()) - 1;
+                bool seen = false;
+                for(auto& run : runs) seen = seen || (run.first <= hi && lo <= run.second);
+                if(!seen) continue;
+                copy->mods[copy->used].version = mod.version;
+                copy->mods[copy->used].type = mod.type;
+                copy->mods[copy->used].node = moved[mod.node];
+                copy->used++;
+            }
+        }
+
+        for(int version : kept) root.publish(version, moved[root[version]]);
+
+        nodes.swap(fresh);
+        auto slabs = fresh.detach();
+        epochs.retire([slabs]() { Alloc<Node>::free(slabs); });
+        epochs.collect();
+    }
+
+    // Visits the keys of a version in order.
+    template<typename Visit>
+    void forEach(Node* node, int version, Visit& visit) {
+        if(!node) return;
+        forEach(getLeft(node, version), version, visit);
+        visit(node->key);
+        forEach(getRight(node, version), version, visit);
+    }
+
+    template<typename Visit>
+    void forEach(int version, Visit visit) {
+        forEach(root[version], version, visit);
+    }
+};
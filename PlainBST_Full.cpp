@@ -1,209 +1,188 @@
-#include <memory>
-#include <map>
-#include <unordered_map>
 #include <vector>
 #include <random>
 #include <chrono>
 #include <algorithm>
 #include <iostream>
 #include <set>
+#include <map>
+#include <numeric>
+#include <stdexcept>
+#include <cstring>
+#include <cstdio>
+#include <unordered_map>
+#include <cstdint>
+#include <thread>
+
+#include "FullTree.h"
+#include "Snapshot.h"
+#include "Journal.h"
+#include "Treap.h"
 
 using namespace std;
 
 mt19937 rng(chrono::steady_clock::now().time_since_epoch().count());
 
-enum Mod {
-    LEFT, RIGHT, EMPTY
+// A node as stored in a snapshot: links are record indices.
+struct SnapshotNode {
+    int32_t key;
+    uint32_t left, right;
+    int32_t modVersion;
+    uint32_t modType;
+    uint32_t modNode;
 };
 
-struct Modification;
-struct Node;
-
-struct Modification {
-
-    int version;
-    Mod type;
-    shared_ptr<Node> node;
-
-    Modification() : version(0), type(EMPTY), node(nullptr) {} 
+// The enter and exit labels of a version, for ancestry checks in a snapshot.
+struct SnapshotLabels {
+    uint64_t enter, exit;
 };
 
-struct Node {
+// The engine with durability and the helpers the tests use: updates can be
+// journaled, and the whole history saved to and restored from a snapshot.
+struct Tree : FullTree<int> {
 
-    int key;
-    shared_ptr<Node> left, right;
-    shared_ptr<Modification> mod;
+    // A batch collects its updates for the journal, which logs them as one
+    // run when it commits.
+    struct Batch : FullTree::Batch {
+        vector<pair<JournalOp, int>> updates;
+    };
 
-    Node(int key) : key(key), left(nullptr), right(nullptr), mod(make_shared<Modification>()) {}
-};
+    Journal* journal;
 
-struct OrderTree {
-
-    unordered_map<int, int> depth;
-    unordered_map<int, vector<int>> parent;
-
-    OrderTree() {
-        depth[0] = 0;
-        parent[0] = vector<int>(31, -1);
-    }
-
-    int findParent(int x, int k) {
-        if(x == -1 || k == 0) return x;
-        for(int i = 30; i >= 0; i--) {
-            if(k >= (1 << i)) return findParent(parent[x][i], k - (1 << i));
-        }
-        return -1;
-    }
-
-    void insert(int x, int y) {
-        depth[y] = depth[x] + 1;
-        parent[y] = vector<int>(31, -1);
-        parent[y][0] = x;
-        for(int i = 1; i < 30; i++) {
-            if(parent[y][i-1] == -1) break;
-            parent[y][i] = parent[parent[y][i-1]][i-1];
-        }
-    }
+    Tree() : journal(nullptr) {}
 
-    bool isAncestor(int x, int y) {
-        return depth[x] <= depth[y] && findParent(y, depth[y] - depth[x]) == x;
+    Batch begin(int version) {
+        return {FullTree::begin(version), {}};
     }
-};
-
-struct Tree {
-
-    int currentVersion;
-    map<int, shared_ptr<Node>> root;
-    OrderTree versions;
 
-    Tree() : currentVersion(0) { root[0] = nullptr; }
-
-    shared_ptr<Node> clone(const shared_ptr<Node>& node) {
-        auto newNode = make_shared<Node>(node->key);
-        newNode->left = getLeft(node);
-        newNode->right = getRight(node);
-        return newNode;
+    void insert(Batch& batch, int key) {
+        FullTree::insert(batch, key);
+        batch.updates.emplace_back(JOURNAL_INSERT, key);
     }
 
-    shared_ptr<Node> getLeft(const shared_ptr<Node>& node, int version) {
-        if(node->mod->type == LEFT && versions.isAncestor(node->mod->version, version)) return node->mod->node;
-        return node->left;
+    void erase(Batch& batch, int key) {
+        FullTree::erase(batch, key);
+        batch.updates.emplace_back(JOURNAL_ERASE, key);
     }
 
-    shared_ptr<Node> getRight(const shared_ptr<Node>& node, int version) {
-        if(node->mod->type == RIGHT && versions.isAncestor(node->mod->version, version)) return node->mod->node;
-        return node->right;
+    int commit(Batch& batch) {
+        int created = FullTree::commit(batch);
+        if(journal) journal->append(batch.updates, created, batch.parent);
+        return created;
     }
 
-    shared_ptr<Node> getLeft(const shared_ptr<Node>& node) {
-        return getLeft(node, currentVersion);
+    int insert(int key, int version) {
+        int created = FullTree::insert(key, version);
+        if(journal) journal->append(JOURNAL_INSERT, key, created, version);
+        return created;
     }
 
-    shared_ptr<Node> getRight(const shared_ptr<Node>& node) {
-        return getRight(node, currentVersion);
+    int erase(int key, int version) {
+        int created = FullTree::erase(key, version);
+        if(journal) journal->append(JOURNAL_ERASE, key, created, version);
+        return created;
     }
 
-    shared_ptr<Node> setLeft(const shared_ptr<Node>& node, const shared_ptr<Node>& left) {
-
-        if(getLeft(node) == left) return node;
-
-        if(node->mod->type == EMPTY) {
-            node->mod->type = LEFT;
-            node->mod->node = left;
-            node->mod->version = currentVersion;
-            return node;
+    // Reapplies journaled updates, each to the parent version it was logged
+    // with. Concurrent writers log in completion order, so records are put
+    // back in version order first; versions the tree already has are
+    // skipped, and replay ends at the first version missing from the log,
+    // as everything after it was never acknowledged as a whole.
+    void replay(const vector<JournalRecord>& records) {
+        auto entries = Journal::entries(records);
+        sort(entries.begin(), entries.end(), [](auto& a, auto& b) { return a.version < b.version; });
+        Journal* attached = journal;
+        journal = nullptr;
+        for(auto& entry : entries) {
+            if(entry.version <= lastVersion()) continue;
+            if(entry.version != lastVersion() + 1) break;
+            auto batch = begin(entry.parent);
+            for(auto& [op, key] : entry.updates) {
+                if(op == JOURNAL_INSERT) insert(batch, key);
+                else erase(batch, key);
+            }
+            commit(batch);
         }
-
-        auto newNode = clone(node);
-        newNode->left = left;
-        return newNode;
+        journal = attached;
     }
 
-    shared_ptr<Node> setRight(const shared_ptr<Node>& node, const shared_ptr<Node>& right) {
-
-        if(getRight(node) == right) return node;
-
-        if(node->mod->type == EMPTY) {
-            node->mod->type = RIGHT;
-            node->mod->node = right;
-            node->mod->version = currentVersion;
-            return node;
-        }
-
-        auto newNode = clone(node);
-        newNode->right = right;
-        return newNode;
+    void recover(const string& snapshotPath, const string& journalPath) {
+        if(access(snapshotPath.c_str(), F_OK) == 0) load(snapshotPath);
+        replay(Journal::read(journalPath));
     }
 
-    shared_ptr<Node> insert(const shared_ptr<Node>& node, int key) {
-
-        if(!node) return make_shared<Node>(key);
-
-        if(key < node->key) {
-            auto left = insert(getLeft(node), key);
-            return setLeft(node, left);
-        }
-
-        if(key > node->key) {
-            auto right = insert(getRight(node), key);
-            return setRight(node, right);
-        }
-
-        return node;
+    // Saves a snapshot and empties the journal; records left by a crash in
+    // between are covered by the snapshot and skipped on replay.
+    void checkpoint(const string& snapshotPath) {
+        if(journal) journal->commit();
+        save(snapshotPath);
+        if(journal) journal->truncate();
     }
 
-    shared_ptr<Node> erase(const shared_ptr<Node>& node, int key) {
+    // Writes every version, with the labels that order the version tree, to
+    // a snapshot that MappedTree queries in place. No writer may be running,
+    // here or in load() and replay().
+    void save(const string& path) {
 
-        if(!node) return nullptr;
+        unordered_map<Node*, uint32_t> index;
+        index[nullptr] = NullRecord;
+        for(size_t i = 0; i < nodes.size(); i++) index[nodes.at(i)] = i;
 
-        if(key < node->key) {
-            auto left = erase(getLeft(node), key);
-            return setLeft(node, left);
+        vector<SnapshotNode> records(nodes.size());
+        for(size_t i = 0; i < nodes.size(); i++) {
+            Node* node = nodes.at(i);
+            records[i] = {node->key, index[node->left], index[node->right], node->mod.version, (uint32_t)node->mod.type, index[node->mod.node]};
         }
 
-        if(key > node->key) {
-            auto right = erase(getRight(node), key);
-            return setRight(node, right);
+        vector<uint32_t> roots(lastVersion() + 1);
+        vector<SnapshotLabels> labels(lastVersion() + 1);
+        for(int version = 0; version <= lastVersion(); version++) {
+            roots[version] = index[root[version]];
+            labels[version] = {versions.label(2 * version), versions.label(2 * version + 1)};
         }
 
-        if(!getLeft(node)) return getRight(node);
-        if(!getRight(node)) return getLeft(node);
+        SnapshotHeader header = {};
+        memcpy(header.magic, "PBSTFULL", 8);
+        header.slots = 1;
+        header.versions = roots.size();
+        header.nodes = records.size();
+
+        SnapshotWriter out(path);
+        out.write(&header, sizeof(header));
+        header.rootsOffset = out.write(roots.data(), roots.size() * sizeof(uint32_t));
+        header.nodesOffset = out.write(records.data(), records.size() * sizeof(SnapshotNode));
+        header.extraOffset = out.write(labels.data(), labels.size() * sizeof(SnapshotLabels));
+        out.finish(header);
+    }
 
-        auto succ = getRight(node);
-        while(getLeft(succ)) succ = getLeft(succ);
+    // Replaces the tree with the one saved in a snapshot, labels included.
+    void load(const string& path) {
 
-        auto newNode = make_shared<Node>(succ->key);
-        newNode->left = getLeft(node);
+        MappedFile file(path, "PBSTFULL");
+        file.check(sizeof(SnapshotNode), sizeof(SnapshotLabels));
+        auto& header = file.header();
+        auto records = file.at<SnapshotNode>(header.nodesOffset);
+        auto roots = file.at<uint32_t>(header.rootsOffset);
 
-        auto right = erase(getRight(node), succ->key);
-        newNode->right = right;
+        clear();
 
-        return newNode;
-    }
+        for(size_t i = 0; i < header.nodes; i++) createNode(records[i].key, 0);
+        auto link = [&](uint32_t record) { return record == NullRecord ? nullptr : nodes.at(record); };
 
-    bool find(int key, int version) {
-        auto node = root[version];
-        while(node) {
-            if(node->key == key) return true;
-            if(key < node->key) node = getLeft(node, version);
-            else node = getRight(node, version);
+        for(size_t i = 0; i < header.nodes; i++) {
+            Node* node = nodes.at(i);
+            node->left = link(records[i].left);
+            node->right = link(records[i].right);
+            node->mod.version = records[i].modVersion;
+            node->mod.type = (Mod)records[i].modType;
+            node->mod.node = link(records[i].modNode);
         }
-        return false;
-    }
-
-    void insert(int key, int version) {
-        ++currentVersion;
-        versions.insert(version, currentVersion);
-        root[currentVersion] = insert(root[version], key);
-    }
 
-    void erase(int key, int version) {
-        ++currentVersion;
-        versions.insert(version, currentVersion);
-        root[currentVersion] = erase(root[version], key);
+        root.publish(0, link(roots[0]));
+        for(int version = 1; version < (int)header.versions; version++) root.append(link(roots[version]));
+        versions.restore(file.at<SnapshotLabels>(header.extraOffset), header.versions);
     }
 
-    void inorder(const shared_ptr<Node>& node, int version) {
+    void inorder(Node* node, int version) {
         if(!node) return;
         inorder(getLeft(node, version), version);
         cout << node->key << " ";
@@ -215,7 +194,7 @@ struct Tree {
         cout << endl;
     }
 
-    set<int> traverse(const shared_ptr<Node>& node, int version) {
+    set<int> traverse(Node* node, int version) {
         if(!node) return {};
         auto left = traverse(getLeft(node, version), version);
         auto right = traverse(getRight(node, version), version);
@@ -231,6 +210,40 @@ struct Tree {
     }
 };
 
+
+// A snapshot written by Tree::save, mapped read-only and queried in place.
+struct MappedTree {
+
+    MappedFile file;
+    const SnapshotNode* nodes;
+    const SnapshotLabels* labels;
+
+    MappedTree(const string& path) : file(path, "PBSTFULL") {
+        file.check(sizeof(SnapshotNode), sizeof(SnapshotLabels));
+        nodes = file.at<SnapshotNode>(file.header().nodesOffset);
+        labels = file.at<SnapshotLabels>(file.header().extraOffset);
+    }
+
+    bool isAncestor(int x, int y) {
+        return labels[x].enter <= labels[y].enter && labels[y].exit <= labels[x].exit;
+    }
+
+    uint32_t getChild(uint32_t node, Mod type, int version) {
+        auto& record = nodes[node];
+        if(record.modType == (uint32_t)type && isAncestor(record.modVersion, version)) return record.modNode;
+        return type == LEFT ? record.left : record.right;
+    }
+
+    bool find(int key, int version) {
+        uint32_t node = file.root(version);
+        while(node != NullRecord) {
+            if(nodes[node].key == key) return true;
+            node = getChild(node, key < nodes[node].key ? LEFT : RIGHT, version);
+        }
+        return false;
+    }
+};
+
 void test() {
 
     Tree tree;
@@ -254,6 +267,7 @@ void test() {
         i++;
     }
 
+    auto guard = tree.pin();
     for(int i = 0; i < 1000; i++) {
         auto res = tree.traverse(i);
         if(res != versions[i]) {
@@ -269,8 +283,310 @@ void test() {
     }
 }
 
+void testSnapshot() {
+
+    Tree tree;
+
+    for(int i = 1; i <= 3000; i++) {
+        int k = uniform_int_distribution<int>(1,200)(rng);
+        int v = uniform_int_distribution<int>(0,i-1)(rng);
+        if(tree.find(k,v)) tree.erase(k,v);
+        else tree.insert(k,v);
+    }
+
+    tree.save("full_snapshot.bin");
+    {
+        MappedTree mapped("full_snapshot.bin");
+        for(int v = 0; v <= tree.lastVersion(); v++) {
+            for(int k = 1; k <= 200; k++) {
+                if(mapped.find(k,v) != tree.find(k,v)) {
+                    cout << "Snapshot mismatch at version " << v << endl;
+                    return;
+                }
+            }
+        }
+    }
+
+    // A snapshot cut short is refused before any record is read.
+    truncate("full_snapshot.bin", 4096);
+    for(int attempt = 0; attempt < 2; attempt++) {
+        try {
+            if(attempt == 0) MappedTree mapped("full_snapshot.bin");
+            else Tree().load("full_snapshot.bin");
+            cout << "Truncated snapshot was accepted" << endl;
+        } catch(const runtime_error&) {}
+    }
+    remove("full_snapshot.bin");
+}
+
+// Journals a random version tree with a checkpoint halfway, then recovers a
+// second tree from the snapshot and the journal and compares every version.
+void testJournal() {
+
+    remove("full_journal.bin");
+    Tree tree;
+
+    {
+        Journal journal("full_journal.bin", 32);
+        tree.journal = &journal;
+        for(int i = 1; i <= 3000; i++) {
+            int v = uniform_int_distribution<int>(0,i-1)(rng);
+            if(i > 2000 && i % 10 == 0) {
+                auto batch = tree.begin(v);
+                for(int j = 0; j < 4; j++) {
+                    int k = uniform_int_distribution<int>(1,200)(rng);
+                    if(tree.find(batch,k)) tree.erase(batch,k);
+                    else tree.insert(batch,k);
+                }
+                tree.commit(batch);
+                continue;
+            }
+            int k = uniform_int_distribution<int>(1,200)(rng);
+            if(tree.find(k,v)) tree.erase(k,v);
+            else tree.insert(k,v);
+            if(i == 1500) tree.checkpoint("full_snapshot.bin");
+        }
+        tree.journal = nullptr;
+    }
+
+    // A batch cut short by a crash.
+    {
+        Journal journal("full_journal.bin");
+        journal.push(JOURNAL_BATCH, 2, tree.lastVersion() + 1, 0);
+        journal.push(JOURNAL_INSERT, 1, tree.lastVersion() + 1, 0);
+    }
+
+    Tree recovered;
+    recovered.recover("full_snapshot.bin", "full_journal.bin");
+
+    if(recovered.lastVersion() != tree.lastVersion()) {
+        cout << "Recovered " << recovered.lastVersion() << " of " << tree.lastVersion() << " versions" << endl;
+    }
+    for(int v = 0; v <= min(tree.lastVersion(), recovered.lastVersion()); v++) {
+        if(recovered.traverse(v) != tree.traverse(v)) {
+            cout << "Recovery mismatch at version " << v << endl;
+            break;
+        }
+    }
+
+    remove("full_journal.bin");
+    remove("full_snapshot.bin");
+}
+
+// Derives random batches of updates from random versions and checks every
+// version against the set its batch should have produced. Repeating updates
+// on one path within a batch must not copy the path again.
+void testBatch() {
+
+    Tree tree;
+    mt19937 gen(11);
+    vector<set<int>> versions(1);
+
+    for(int i = 0; i < 2000; i++) {
+        int parent = gen() % versions.size();
+        set<int> keys = versions[parent];
+        auto batch = tree.begin(parent);
+        for(int j = 1 + gen() % 8; j > 0; j--) {
+            int key = gen() % 200;
+            if(keys.count(key)) tree.erase(batch, key), keys.erase(key);
+            else tree.insert(batch, key), keys.insert(key);
+        }
+        tree.commit(batch);
+        versions.push_back(keys);
+    }
+
+    for(int v = 0; v <= tree.lastVersion(); v++) {
+        if(tree.traverse(v) != versions[v]) {
+            cout << "Batch mismatch at version " << v << endl;
+            return;
+        }
+    }
+
+    int v = tree.lastVersion(), key = 0;
+    while(versions[v].count(key)) key++;
+    size_t before = tree.nodes.size();
+    auto batch = tree.begin(v);
+    tree.insert(batch, key);
+    size_t single = tree.nodes.size() - before;
+    for(int i = 0; i < 10; i++) tree.erase(batch, key), tree.insert(batch, key);
+    tree.commit(batch);
+    size_t batched = tree.nodes.size() - before;
+
+    // Deriving from an unknown version throws and leaves no id behind.
+    int last = tree.lastVersion();
+    for(int parent : {-1, last + 1, last + 1000}) {
+        try {
+            tree.insert(1, parent);
+            cout << "Insert into unknown version " << parent << " did not throw" << endl;
+        } catch(const out_of_range&) {}
+    }
+    if(tree.lastVersion() != last || tree.insert(1, last) != last + 1) cout << "Unknown parents left versions behind" << endl;
+
+    // Only the re-inserted leaves are new.
+    if(batched > single + 10) cout << "Batch of 21 updates on one path allocated " << batched << " nodes, the first insert " << single << endl;
+    else cout << "Batches matched all " << tree.lastVersion() << " versions" << endl;
+}
+
+// The engine on pair keys in descending order, with random parents, against
+// a set per version.
+void testKeys() {
+
+    using Key = pair<int, int>;
+    FullTree<Key, greater<Key>> tree;
+    mt19937 gen(13);
+    vector<set<Key, greater<Key>>> versions(1);
+
+    for(int i = 0; i < 2000; i++) {
+        int parent = gen() % versions.size();
+        Key key(gen() % 10, gen() % 10);
+        auto keys = versions[parent];
+        if(tree.find(key, parent)) tree.erase(key, parent), keys.erase(key);
+        else tree.insert(key, parent), keys.insert(key);
+        versions.push_back(keys);
+    }
+
+    for(int v = 0; v <= tree.lastVersion(); v++) {
+        for(int k = 0; k < 100; k++) {
+            Key key(k / 10, k % 10);
+            if(tree.find(key, v) != (versions[v].count(key) > 0)) {
+                cout << "Pair key mismatch at version " << v << endl;
+                return;
+            }
+        }
+    }
+    cout << "Pair keys matched all " << tree.lastVersion() << " versions" << endl;
+}
+
+// Several threads fork branches at once, off a shared base history and off
+// their own earlier versions, then every version is checked against the set
+// its writer expected.
+void testConcurrent() {
+
+    Tree tree;
+    map<int, set<int>> expected = {{0, {}}};
+
+    for(int i = 1; i <= 200; i++) {
+        int k = uniform_int_distribution<int>(1,100)(rng);
+        expected[i] = expected[i - 1];
+        expected[i].insert(k);
+        tree.insert(k, i - 1);
+    }
+
+    vector<map<int, set<int>>> created(4);
+    vector<thread> writers;
+    for(int w = 0; w < 4; w++) {
+        writers.emplace_back([&, w, seed = rng()]() {
+            mt19937 gen(seed);
+            vector<int> own;
+            for(int i = 0; i < 2000; i++) {
+                int k = gen() % 100 + 1;
+                int v = own.empty() || gen() % 4 == 0 ? gen() % 201 : own[gen() % own.size()];
+                set<int> keys = v <= 200 ? expected.at(v) : created[w].at(v);
+                int version;
+                if(tree.find(k,v)) {
+                    version = tree.erase(k,v);
+                    keys.erase(k);
+                } else {
+                    version = tree.insert(k,v);
+                    keys.insert(k);
+                }
+                created[w][version] = keys;
+                own.push_back(version);
+            }
+        });
+    }
+    for(auto& writer : writers) writer.join();
+
+    for(auto& versions : created) expected.insert(versions.begin(), versions.end());
+    if((int)expected.size() != tree.lastVersion() + 1) cout << "Concurrent writers lost versions" << endl;
+    for(auto& [v, keys] : expected) {
+        if(tree.traverse(v) != keys) {
+            cout << "Concurrent mismatch at version " << v << endl;
+            return;
+        }
+    }
+}
+
+void testTreap() {
+
+    Treap<int> tree(rng());
+
+    vector<set<int>> versions(1);
+
+    for(int i = 1; i <= 3000; i++) {
+        int op = uniform_int_distribution<int>(0,9)(rng);
+        int v = uniform_int_distribution<int>(0,tree.lastVersion())(rng);
+        int k = uniform_int_distribution<int>(1,1000)(rng);
+        if(op < 6) {
+            tree.insert(k,v);
+            versions.push_back(versions[v]);
+            versions.back().insert(k);
+        } else if(op < 8) {
+            tree.erase(k,v);
+            versions.push_back(versions[v]);
+            versions.back().erase(k);
+        } else if(op < 9) {
+            tree.split(v,k);
+            versions.push_back(set<int>(versions[v].begin(), versions[v].lower_bound(k)));
+            versions.push_back(set<int>(versions[v].lower_bound(k), versions[v].end()));
+            int low = tree.lastVersion() - 1, high = tree.lastVersion();
+            tree.join(low,high);
+            versions.push_back(versions[v]);
+        } else {
+            int lo = k, hi = k + 50;
+            auto moved = tree.moveRange(v,0,lo,hi);
+            versions.push_back(versions[v]);
+            versions.push_back({});
+            for(int x : versions[v]) {
+                if(x >= lo && x < hi) {
+                    versions[moved.first].erase(x);
+                    versions[moved.second].insert(x);
+                }
+            }
+        }
+    }
+
+    for(int i = 0; i <= tree.lastVersion(); i++) {
+        set<int> res;
+        tree.forEach(i, [&](int key) { res.insert(key); });
+        if(res != versions[i]) {
+            cout << "Treap mismatch at version " << i << endl;
+            return;
+        }
+    }
+
+    vector<int> sorted(100000);
+    iota(sorted.begin(), sorted.end(), 0);
+    int v = 0;
+    for(int k : sorted) v = tree.insert(k,v);
+    cout << "Treap depth after " << sorted.size() << " sorted inserts: " << tree.depth(v) << endl;
+
+    // Under a descending order the low part of a split holds the larger keys.
+    Treap<pair<int, int>, greater<>> down(rng());
+    int w = 0;
+    for(int k = 0; k < 10; k++) w = down.insert({k, -k}, w);
+    auto [high, low] = down.split(w, {5, -5});
+    int joined = down.join(high, low);
+    if(down.find({5, -5}, high) || !down.find({6, -6}, high) || !down.find({5, -5}, low) || !down.find({0, 0}, joined)) {
+        cout << "Treap split under a custom order is wrong" << endl;
+        return;
+    }
+
+    // An insert of a present key still makes a version, sharing its parent's root.
+    int again = tree.insert(0, v);
+    if(again != tree.lastVersion() || tree.root[again] != tree.root[v]) {
+        cout << "Treap duplicate insert copied the tree" << endl;
+        return;
+    }
+}
 
 int main() {
 
     test();
+    testBatch();
+    testKeys();
+    testSnapshot();
+    testJournal();
+    testConcurrent();
+    testTreap();
 }
\ No newline at end of file
@@ -1,228 +1,655 @@
 #include <memory>
-#include <map>
 #include <vector>
 #include <numeric>
 #include <random>
 #include <chrono>
 #include <algorithm>
 #include <iostream>
+#include <string>
+#include <unordered_map>
+#include <set>
+#include <tuple>
+#include <climits>
+#include <cstring>
+#include <cstdio>
+#include <stdexcept>
+#include <atomic>
+#include <thread>
+
+#include "PartialTree.h"
+#include "Snapshot.h"
+#include "Journal.h"
 
 using namespace std;
 
 mt19937 rng(chrono::steady_clock::now().time_since_epoch().count());
 
-enum Mod {
-    LEFT, RIGHT, EMPTY
-};
+// A node as stored in a snapshot: links are record indices.
+template<int K>
+struct SnapshotNode {
 
-struct Modification;
-struct Node;
-struct Tree;
+    struct Slot {
+        int32_t version;
+        uint32_t type;
+        uint32_t node;
+    };
 
-struct Modification {
+    int32_t key;
+    uint32_t left, right;
+    uint32_t used;
+    Slot mods[K];
+};
 
-    int version;
-    Mod type;
-    shared_ptr<Node> node;
+// The int-keyed engine with durability: updates can be journaled, and the
+// whole history saved to and restored from a snapshot.
+template<int K = 1>
+struct Tree : PartialTree<int, less<int>, Arena, K> {
+
+    using Base = PartialTree<int, less<int>, Arena, K>;
+    using Node = typename Base::Node;
+    using Base::currentVersion;
+    using Base::retiredBelow;
+    using Base::latest;
+    using Base::root;
+    using Base::nodes;
+    using Base::batching;
+
+    Journal* journal;
+    vector<pair<JournalOp, int>> batched;
+
+    Tree() : journal(nullptr) {}
+
+    // A batch is journaled as a whole when it commits.
+    void commit() {
+        Base::commit();
+        if(journal) journal->append(batched, currentVersion, currentVersion - 1);
+        batched.clear();
+    }
 
-    Modification() : version(0), type(EMPTY), node(nullptr) {} 
-};
+    void insert(int key) {
+        Base::insert(key);
+        if(batching) batched.emplace_back(JOURNAL_INSERT, key);
+        else if(journal) journal->append(JOURNAL_INSERT, key, currentVersion, currentVersion - 1);
+    }
 
-struct Node {
+    void erase(int key) {
+        Base::erase(key);
+        if(batching) batched.emplace_back(JOURNAL_ERASE, key);
+        else if(journal) journal->append(JOURNAL_ERASE, key, currentVersion, currentVersion - 1);
+    }
 
-    int key;
-    shared_ptr<Node> left, right;
-    shared_ptr<Modification> mod;
+    // Reapplies journaled updates, a version at a time. Versions the tree
+    // already has (those a snapshot covered) are skipped; the rest must
+    // follow on directly.
+    void replay(const vector<JournalRecord>& records) {
+        Journal* attached = journal;
+        journal = nullptr;
+        for(auto& entry : Journal::entries(records)) {
+            if(entry.version <= currentVersion) continue;
+            if(entry.version != currentVersion + 1) throw runtime_error("journal is missing version " + to_string(currentVersion + 1));
+            this->begin();
+            for(auto& [op, key] : entry.updates) {
+                if(op == JOURNAL_INSERT) insert(key);
+                else erase(key);
+            }
+            commit();
+        }
+        journal = attached;
+    }
 
-    Node(int key) : key(key), left(nullptr), right(nullptr), mod(make_shared<Modification>()) {}
-};
+    // Rebuilds the state of the last run: the snapshot, if there is one,
+    // then whatever the journal holds beyond it.
+    void recover(const string& snapshotPath, const string& journalPath) {
+        if(access(snapshotPath.c_str(), F_OK) == 0) load(snapshotPath);
+        replay(Journal::read(journalPath));
+    }
 
-struct Tree {
-    
-    int currentVersion;
-    map<int, shared_ptr<Node>> root;
+    // Saves a snapshot and empties the journal it makes redundant. A crash in
+    // between leaves records the snapshot already covers, which replay skips.
+    void checkpoint(const string& snapshotPath) {
+        if(journal) journal->commit();
+        save(snapshotPath);
+        if(journal) journal->truncate();
+    }
 
-    Tree() : currentVersion(0) { root[0] = nullptr; }
+    // Writes every version to a snapshot that MappedTree queries in place.
+    // Records follow the arena, so each version's nodes stay together.
+    void save(const string& path) {
+
+        unordered_map<Node*, uint32_t> index;
+        index[nullptr] = NullRecord;
+        for(size_t i = 0; i < nodes.size(); i++) index[nodes.at(i)] = i;
+
+        vector<SnapshotNode<K>> records(nodes.size());
+        for(size_t i = 0; i < nodes.size(); i++) {
+            Node* node = nodes.at(i);
+            auto& record = records[i];
+            record.key = node->key;
+            record.left = index[node->left];
+            record.right = index[node->right];
+            record.used = node->used;
+            for(int j = 0; j < K; j++) {
+                record.mods[j].version = node->mods[j].version;
+                record.mods[j].type = node->mods[j].type;
+                record.mods[j].node = j < node->used ? index[node->mods[j].node] : NullRecord;
+            }
+        }
 
-    shared_ptr<Node> clone(const shared_ptr<Node>& node) {
-        auto newNode = make_shared<Node>(node->key);
-        newNode->left = node->mod->type == LEFT ? node->mod->node : node->left;
-        newNode->right = node->mod->type == RIGHT ? node->mod->node : node->right;
-        return newNode;
+        vector<uint32_t> roots(currentVersion + 1);
+        for(int version = 0; version <= currentVersion; version++) {
+            roots[version] = root.contains(version) ? index[root[version]] : RetiredVersion;
+        }
+
+        SnapshotHeader header = {};
+        memcpy(header.magic, "PBSTPART", 8);
+        header.slots = K;
+        header.versions = roots.size();
+        header.nodes = records.size();
+
+        SnapshotWriter out(path);
+        out.write(&header, sizeof(header));
+        header.rootsOffset = out.write(roots.data(), roots.size() * sizeof(uint32_t));
+        header.nodesOffset = out.write(records.data(), records.size() * sizeof(SnapshotNode<K>));
+        out.finish(header);
     }
 
-    shared_ptr<Node> getRoot() {
-        auto it = root.rbegin();
-        return it->second;
+    // Replaces the tree with the one saved in a snapshot, record for record,
+    // so none of the history it covers has to be redone.
+    void load(const string& path) {
+
+        MappedFile file(path, "PBSTPART");
+        auto& header = file.header();
+        if(header.slots != K) throw runtime_error("snapshot was written with a different slot count");
+        file.check(sizeof(SnapshotNode<K>));
+        auto records = file.at<SnapshotNode<K>>(header.nodesOffset);
+        auto roots = file.at<uint32_t>(header.rootsOffset);
+
+        this->clear();
+
+        for(size_t i = 0; i < header.nodes; i++) this->createNode(records[i].key);
+        auto link = [&](uint32_t record) { return record == NullRecord ? nullptr : nodes.at(record); };
+
+        for(size_t i = 0; i < header.nodes; i++) {
+            Node* node = nodes.at(i);
+            auto& record = records[i];
+            node->left = link(record.left);
+            node->right = link(record.right);
+            node->used = record.used;
+            for(int j = 0; j < (int)record.used; j++) {
+                node->mods[j].version = record.mods[j].version;
+                node->mods[j].type = (Mod)record.mods[j].type;
+                node->mods[j].node = link(record.mods[j].node);
+            }
+        }
+
+        for(int version = 0; version < (int)header.versions; version++) {
+            Node* node = roots[version] == RetiredVersion ? nullptr : link(roots[version]);
+            if(version == 0) root.publish(0, node);
+            else root.append(node);
+            if(roots[version] == RetiredVersion) root.retract(version);
+        }
+
+        currentVersion = header.versions - 1;
+        latest.store(currentVersion, memory_order_release);
+        while(retiredBelow < currentVersion && !root.contains(retiredBelow)) retiredBelow++;
     }
 
-    shared_ptr<Node> getLeft(const shared_ptr<Node>& node, int version) {
-        if(node->mod->type == LEFT && node->mod->version <= version) return node->mod->node;
-        return node->left;
+    void inorder(int version) {
+        this->forEach(version, [](int key) { cout << key << " "; });
+        cout << endl;
     }
+};
+
+// A snapshot written by Tree::save, mapped read-only and queried in place.
+template<int K = 1>
+struct MappedTree {
 
-    shared_ptr<Node> getRight(const shared_ptr<Node>& node, int version) {
-        if(node->mod->type == RIGHT && node->mod->version <= version) return node->mod->node;
-        return node->right;
+    MappedFile file;
+    const SnapshotNode<K>* nodes;
+
+    MappedTree(const string& path) : file(path, "PBSTPART") {
+        if(file.header().slots != K) throw runtime_error("snapshot was written with a different slot count");
+        file.check(sizeof(SnapshotNode<K>));
+        nodes = file.at<SnapshotNode<K>>(file.header().nodesOffset);
     }
 
-    shared_ptr<Node> getLeft(const shared_ptr<Node>& node) {
-        if(node->mod->type == LEFT) return node->mod->node;
-        return node->left;
+    uint32_t getChild(uint32_t node, Mod type, int version) {
+        auto& record = nodes[node];
+        for(int i = record.used - 1; i >= 0; i--) {
+            if(record.mods[i].type == (uint32_t)type && record.mods[i].version <= version) return record.mods[i].node;
+        }
+        return type == LEFT ? record.left : record.right;
     }
 
-    shared_ptr<Node> getRight(const shared_ptr<Node>& node) {
-        if(node->mod->type == RIGHT) return node->mod->node;
-        return node->right;
+    bool find(int key, int version) {
+        uint32_t node = file.root(version);
+        while(node != NullRecord) {
+            if(nodes[node].key == key) return true;
+            node = getChild(node, key < nodes[node].key ? LEFT : RIGHT, version);
+        }
+        return false;
     }
+};
+
+void test() {
+
+    Tree<> tree;
 
-    shared_ptr<Node> setLeft(const shared_ptr<Node>& node, const shared_ptr<Node>& left) {
-        
-        if(getLeft(node) == left) return node;
+    vector<int> keys(20);
+    iota(keys.begin(), keys.begin() + 10, 1);
+    iota(keys.begin() + 10, keys.end(), 1);
+    shuffle(keys.begin(), keys.end(), rng);
 
-        if(node->mod->type == EMPTY) {
-            node->mod->type = LEFT;
-            node->mod->node = left;
-            node->mod->version = currentVersion;
-            return node;
+    for(int key : keys) {
+        if(tree.find(key)) {
+            cout << "Erasing key " << key << endl;
+            tree.erase(key);
+        } else {
+            cout << "Inserting key " << key << endl;
+            tree.insert(key);
         }
+    }
 
-        auto newNode = clone(node);
-        newNode->left = left;
-        return newNode;
+    for(int i = 0; i <= 20; i++) {
+        cout << "Version " << i << endl;
+        tree.inorder(i);
     }
+}
+
+// Runs a long random history, keeping only the newest window versions, and
+// checks every retained version against a plain set after each collection.
+void testRetention() {
 
-    shared_ptr<Node> setRight(const shared_ptr<Node>& node, const shared_ptr<Node>& right) {
-        
-        if(getRight(node) == right) return node;
+    Tree<2> tree;
+    mt19937 gen(3);
 
-        if(node->mod->type == EMPTY) {
-            node->mod->type = RIGHT;
-            node->mod->node = right;
-            node->mod->version = currentVersion;
-            return node;
+    int window = 300, keys = 500;
+    vector<vector<bool>> expected(1, vector<bool>(keys));
+
+    for(int i = 1; i <= 20000; i++) {
+        int key = gen() % keys;
+        expected.push_back(expected.back());
+        if(tree.find(key)) {
+            tree.erase(key);
+            expected.back()[key] = false;
+        } else {
+            tree.insert(key);
+            expected.back()[key] = true;
         }
 
-        auto newNode = clone(node);
-        newNode->right = right;
-        return newNode;
+        if(i % 1000 == 0) {
+            tree.keepLast(window);
+            for(int version = i - window + 1; version <= i; version++) {
+                for(int k = 0; k < keys; k++) {
+                    if(tree.find(k, version) != expected[version][k]) {
+                        cout << "Retention mismatch at version " << version << endl;
+                        return;
+                    }
+                }
+            }
+            if(tree.root.contains(i - window)) {
+                cout << "Version " << i - window << " was not retired" << endl;
+                return;
+            }
+            cout << "After " << i << " updates: " << tree.nodes.size() << " live nodes" << endl;
+        }
     }
 
-    shared_ptr<Node> insertKey(const shared_ptr<Node>& node, int key) {
-
-        if(!node) return make_shared<Node>(key);
+    // Asking for fewer than one version still keeps the latest writable.
+    int latest = tree.currentVersion;
+    tree.keepLast(0);
+    if(!tree.root.contains(latest) || tree.root.contains(latest - 1)) {
+        cout << "keepLast(0) did not keep exactly the latest version" << endl;
+        return;
+    }
+    int key = 0;
+    while(expected[latest][key]) key++;
+    tree.insert(key);
+    if(!tree.find(key, latest + 1) || tree.find(key, latest)) cout << "Insert after keepLast(0) went wrong" << endl;
+}
 
-        if(key < node->key) {
-            auto left = insertKey(getLeft(node), key);
-            return setLeft(node, left);
+// Applies random batches of updates, each as one version, and checks every
+// version against a plain set. Repeating updates on one path within a batch
+// must not copy the path again.
+void testBatch() {
+
+    Tree<1> tree;
+    mt19937 gen(9);
+    vector<set<int>> history(1);
+
+    for(int i = 0; i < 2000; i++) {
+        set<int> keys = history.back();
+        tree.begin();
+        for(int j = 1 + gen() % 8; j > 0; j--) {
+            int key = gen() % 200;
+            if(keys.count(key)) tree.erase(key), keys.erase(key);
+            else tree.insert(key), keys.insert(key);
         }
+        tree.commit();
+        history.push_back(keys);
+    }
 
-        if(key > node->key) {
-            auto right = insertKey(getRight(node), key);
-            return setRight(node, right);
+    for(int version = 0; version <= tree.currentVersion; version++) {
+        for(int key = 0; key < 200; key++) {
+            if(tree.find(key, version) != (bool)history[version].count(key)) {
+                cout << "Batch mismatch at version " << version << endl;
+                return;
+            }
         }
-
-        return node;
     }
 
-    shared_ptr<Node> deleteKey(const shared_ptr<Node>& node, int key) {
+    int key = 0;
+    while(history.back().count(key)) key++;
+    size_t before = tree.nodes.size();
+    tree.begin();
+    tree.insert(key);
+    size_t single = tree.nodes.size() - before;
+    for(int i = 0; i < 10; i++) tree.erase(key), tree.insert(key);
+    tree.commit();
+    size_t batch = tree.nodes.size() - before;
+
+    // Reclaiming while a batch is open would strand the batch's nodes.
+    int latest = tree.currentVersion;
+    tree.begin();
+    tree.insert(key + 1);
+    try {
+        tree.keepLast(1);
+        cout << "keepLast inside a batch did not throw" << endl;
+    } catch(const logic_error&) {}
+    tree.commit();
+    if(!tree.root.contains(latest) || !tree.find(key + 1, latest + 1) || !tree.find(key, latest + 1)) cout << "Batch lost after a refused keepLast" << endl;
+
+    // Only the re-inserted leaves are new.
+    if(batch > single + 10) cout << "Batch of 21 updates on one path allocated " << batch << " nodes, the first insert " << single << endl;
+    else cout << "Batches matched all " << tree.currentVersion << " versions" << endl;
+}
 
-        if(!node) return nullptr;
+// Same update and query stream for every slot count, so the node counts
+// and query times are directly comparable.
+template<int K>
+void benchmarkSlots(int updates, int queries) {
 
-        if(key < node->key) {
-            auto left = deleteKey(getLeft(node), key);
-            return setLeft(node, left);
-        }
+    Tree<K> tree;
+    mt19937 gen(1);
 
-        if(key > node->key) {
-            auto right = deleteKey(getRight(node), key);
-            return setRight(node, right);
-        }
+    for(int i = 0; i < updates; i++) {
+        int key = gen() % updates;
+        if(tree.find(key)) tree.erase(key);
+        else tree.insert(key);
+    }
 
-        if(!getLeft(node)) return getRight(node);
-        if(!getRight(node)) return getLeft(node);
+    vector<pair<int, int>> probes(queries);
+    for(auto& p : probes) p = {(int)(gen() % updates), (int)(gen() % (updates + 1))};
 
-        auto succ = getRight(node);
-        while(getLeft(succ)) succ = getLeft(succ);
+    auto start = chrono::steady_clock::now();
+    int found = 0;
+    for(auto& p : probes) found += tree.find(p.first, p.second);
+    auto end = chrono::steady_clock::now();
 
-        auto newNode = make_shared<Node>(succ->key);
-        newNode->left = getLeft(node);
+    cout << "k=" << K << ": "
+         << tree.nodes.size() << " nodes (" << 1.0 * tree.nodes.size() / updates << " per update, "
+         << sizeof(typename Tree<K>::Node) << " bytes each), "
+         << chrono::duration<double, nano>(end - start).count() / queries << " ns per query"
+         << " (" << found << " hits)" << endl;
+}
+
+void benchmarkBatch(int updates, int queries) {
 
-        auto right = deleteKey(getRight(node), succ->key);
-        newNode->right = right;
+    Tree<> tree;
+    mt19937 gen(2);
 
-        return newNode;
+    for(int i = 0; i < updates; i++) {
+        int key = gen() % updates;
+        if(tree.find(key)) tree.erase(key);
+        else tree.insert(key);
     }
 
-    bool find(int key, int version) {
-        auto node = root[version];
-        while(node) {
-            if(node->key == key) return true;
-            if(key < node->key) node = getLeft(node, version);
-            else node = getRight(node, version);
+    vector<pair<int, int>> probes(queries);
+    for(auto& p : probes) p = {(int)(gen() % updates), (int)(gen() % (updates + 1))};
+
+    unique_ptr<bool[]> scalar(new bool[queries]), batched(new bool[queries]);
+
+    auto start = chrono::steady_clock::now();
+    for(int i = 0; i < queries; i++) scalar[i] = tree.find(probes[i].first, probes[i].second);
+    auto middle = chrono::steady_clock::now();
+    tree.find(probes.data(), probes.size(), batched.get());
+    auto end = chrono::steady_clock::now();
+
+    bool same = equal(scalar.get(), scalar.get() + queries, batched.get());
+
+    cout << "Batch lookup of " << queries << " queries: scalar "
+         << chrono::duration<double, nano>(middle - start).count() / queries << " ns, batched "
+         << chrono::duration<double, nano>(end - middle).count() / queries << " ns per query"
+         << (same ? "" : " (RESULTS DIFFER)") << endl;
+}
+
+// A writer keeps creating versions while a growing number of readers query
+// random published ones; reports each side's throughput.
+void benchmarkConcurrent(int updates) {
+
+    int maxReaders = max(2u, thread::hardware_concurrency());
+
+    for(int count = 1; count <= maxReaders; count *= 2) {
+
+        Tree<2> tree;
+        mt19937 gen(7);
+        for(int i = 0; i < updates; i++) {
+            int key = gen() % updates;
+            if(tree.find(key)) tree.erase(key);
+            else tree.insert(key);
         }
-        return false;
-    }
 
-    bool find(int key) {
-        auto node = getRoot();
-        while(node) {
-            if(node->key == key) return true;
-            if(key < node->key) node = getLeft(node);
-            else node = getRight(node);
+        atomic<bool> done(false);
+        atomic<long long> queries(0), hits(0);
+        vector<thread> readers;
+
+        for(int r = 0; r < count; r++) {
+            readers.emplace_back([&, r]() {
+                mt19937 local(r);
+                long long answered = 0, found = 0;
+                while(!done.load(memory_order_relaxed)) {
+                    auto guard = tree.pin();
+                    for(int i = 0; i < 1024; i++) {
+                        int version = local() % (tree.latestVersion() + 1);
+                        found += tree.find(local() % updates, version);
+                    }
+                    answered += 1024;
+                }
+                queries += answered;
+                hits += found;
+            });
         }
-        return false;
-    }
 
-    void insert(int key) {
-        currentVersion++;
-        root[currentVersion] = insertKey(getRoot(), key);
+        auto start = chrono::steady_clock::now();
+        long long written = 0;
+        while(chrono::steady_clock::now() - start < chrono::milliseconds(500)) {
+            int key = gen() % updates;
+            if(tree.find(key)) tree.erase(key);
+            else tree.insert(key);
+            written++;
+        }
+        done = true;
+        for(auto& reader : readers) reader.join();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        cout << count << " readers: " << queries / seconds / 1e6 << "M queries/s, "
+             << written / seconds / 1e3 << "K updates/s (" << hits << " hits)" << endl;
     }
+}
 
-    void erase(int key) {
-        currentVersion++;
-        root[currentVersion] = deleteKey(getRoot(), key);
+void testSnapshot() {
+
+    Tree<2> tree;
+    mt19937 gen(4);
+
+    for(int i = 0; i < 5000; i++) {
+        int key = gen() % 1000;
+        if(tree.find(key)) tree.erase(key);
+        else tree.insert(key);
+    }
+    tree.keepLast(3000);
+
+    tree.save("partial_snapshot.bin");
+    {
+        MappedTree<2> mapped("partial_snapshot.bin");
+        for(int version = tree.currentVersion - 2999; version <= tree.currentVersion; version += 7) {
+            for(int key = 0; key < 1000; key++) {
+                if(mapped.find(key, version) != tree.find(key, version)) {
+                    cout << "Snapshot mismatch at version " << version << endl;
+                    return;
+                }
+            }
+        }
+        cout << "Snapshot of " << tree.currentVersion << " versions: " << mapped.file.size << " bytes" << endl;
     }
 
-    void inorder(const shared_ptr<Node>& node, int version) {
-        if(!node) return;
-        inorder(getLeft(node, version), version);
-        cout << node->key << " ";
-        inorder(getRight(node, version), version);
+    // A snapshot cut short is refused before any record is read.
+    truncate("partial_snapshot.bin", 4096);
+    for(int attempt = 0; attempt < 2; attempt++) {
+        try {
+            if(attempt == 0) MappedTree<2> mapped("partial_snapshot.bin");
+            else Tree<2>().load("partial_snapshot.bin");
+            cout << "Truncated snapshot was accepted" << endl;
+        } catch(const runtime_error&) {}
     }
+    remove("partial_snapshot.bin");
+}
 
-    void inorder(int version) {
-        inorder(root[version], version);
-        cout << endl;
+// One writer inserts a shuffled range of keys and then erases them in the
+// same order while readers query published versions; version v of the
+// history is known exactly, so every answer a reader gets can be checked.
+void testConcurrent() {
+
+    Tree<2> tree;
+    int n = 20000;
+    vector<int> order(n), position(n);
+    iota(order.begin(), order.end(), 0);
+    shuffle(order.begin(), order.end(), mt19937(6));
+    for(int i = 0; i < n; i++) position[order[i]] = i;
+
+    atomic<bool> done(false);
+    atomic<int> wrong(0);
+    vector<thread> readers;
+
+    for(int r = 0; r < 4; r++) {
+        readers.emplace_back([&, r]() {
+            mt19937 gen(r);
+            while(!done.load()) {
+                auto guard = tree.pin();
+                for(int i = 0; i < 256; i++) {
+                    int version = gen() % (tree.latestVersion() + 1), key = gen() % n;
+                    bool expected = version <= n ? position[key] < version : position[key] >= version - n;
+                    if(tree.find(key, version) != expected) wrong++;
+                }
+            }
+        });
     }
-};
 
-void test() {
+    for(int key : order) tree.insert(key);
+    for(int key : order) tree.erase(key);
+    done = true;
+    for(auto& reader : readers) reader.join();
 
-    Tree tree;
+    if(wrong > 0) cout << wrong << " wrong answers from concurrent readers" << endl;
+    else cout << "Concurrent readers agreed on all " << tree.currentVersion << " versions" << endl;
+}
 
-    vector<int> keys(20);
-    iota(keys.begin(), keys.begin() + 10, 1);
-    iota(keys.begin() + 10, keys.end(), 1);
-    shuffle(keys.begin(), keys.end(), rng);
+// Journals a random history with a checkpoint halfway, tears the last record
+// the way a crash would, and recovers a second tree from the snapshot and the
+// journal, which must agree with the first on every retained version.
+void testJournal() {
+
+    remove("partial_journal.bin");
+    Tree<2> tree;
+    mt19937 gen(5);
+
+    {
+        Journal journal("partial_journal.bin", 32);
+        tree.journal = &journal;
+        for(int i = 1; i <= 3000; i++) {
+            bool batch = i > 2000 && i % 10 == 0;
+            if(batch) tree.begin();
+            for(int j = batch ? 4 : 1; j > 0; j--) {
+                int key = gen() % 500;
+                if(tree.find(key)) tree.erase(key);
+                else tree.insert(key);
+            }
+            if(batch) tree.commit();
+            if(i == 1500) {
+                tree.keepLast(1000);
+                tree.checkpoint("partial_snapshot.bin");
+            }
+        }
+        tree.journal = nullptr;
+    }
 
-    for(int key : keys) {
-        if(tree.find(key)) {
-            cout << "Erasing key " << key << endl;
-            tree.erase(key);
-        } else {
-            cout << "Inserting key " << key << endl;
-            tree.insert(key);
+    // A batch cut short, then a torn record.
+    {
+        Journal journal("partial_journal.bin");
+        journal.push(JOURNAL_BATCH, 3, tree.currentVersion + 1, tree.currentVersion);
+        journal.push(JOURNAL_INSERT, 1, tree.currentVersion + 1, tree.currentVersion);
+    }
+    FILE* file = fopen("partial_journal.bin", "ab");
+    fwrite("torn", 1, 4, file);
+    fclose(file);
+
+    Tree<2> recovered;
+    recovered.recover("partial_snapshot.bin", "partial_journal.bin");
+
+    if(recovered.currentVersion != tree.currentVersion) {
+        cout << "Recovered " << recovered.currentVersion << " of " << tree.currentVersion << " versions" << endl;
+    } else {
+        for(int version = 0; version <= tree.currentVersion; version++) {
+            if(recovered.root.contains(version) != tree.root.contains(version)) {
+                cout << "Recovery mismatch in retained versions at " << version << endl;
+                break;
+            }
+            if(!tree.root.contains(version)) continue;
+            for(int key = 0; key < 500; key++) {
+                if(recovered.find(key, version) != tree.find(key, version)) {
+                    cout << "Recovery mismatch at version " << version << endl;
+                    version = tree.currentVersion;
+                    break;
+                }
+            }
         }
+        cout << "Recovered " << recovered.currentVersion << " versions from "
+             << Journal::read("partial_journal.bin").size() << " journal records" << endl;
     }
 
-    for(int i = 0; i <= 20; i++) {
-        cout << "Version " << i << endl;
-        tree.inorder(i);
+    remove("partial_journal.bin");
+    remove("partial_snapshot.bin");
+
+    // A journal that cannot be written reports it from commit(); its
+    // destructor swallows the error rather than terminating.
+    if(access("/dev/full", W_OK) == 0) {
+        Journal full("/dev/full");
+        full.append(JOURNAL_INSERT, 1, 1, 0);
+        try {
+            full.commit();
+            cout << "Commit to a full device did not throw" << endl;
+        } catch(const runtime_error&) {}
+        full.append(JOURNAL_INSERT, 2, 2, 1);
     }
 }
 
-int main() {
+int main(int argc, char** argv) {
+
+    if(argc > 1 && string(argv[1]) == "bench") {
+        int updates = argc > 2 ? stoi(argv[2]) : 200000;
+        benchmarkSlots<1>(updates, 1000000);
+        benchmarkSlots<2>(updates, 1000000);
+        benchmarkSlots<3>(updates, 1000000);
+        benchmarkSlots<4>(updates, 1000000);
+        benchmarkBatch(updates, 1000000);
+        benchmarkConcurrent(updates);
+        return 0;
+    }
 
     test();
+    testRetention();
+    testBatch();
+    testSnapshot();
+    testJournal();
+    testConcurrent();
 }
\ No newline at end of file
@@ -0,0 +1,603 @@
+// Partially persistent red-black tree
+
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <functional>
+#include <vector>
+
+#include "Arena.h"
+#include "FatNode.h"
+#include "Stats.h"
+#include "VersionTable.h"
+
+enum Color {
+    RED, BLACK
+};
+
+// K modification slots, filled in version order; see setLeft/setRight.
+template<typename Key, int K>
+struct RedBlackNode {
+
+    Key key;
+    Color color;
+    int version;
+    int used;
+    RedBlackNode *left, *right;
+    Modification<RedBlackNode> mods[K];
+
+    RedBlackNode(const Key& key, int version) :
+        key(key), 
+        color(RED),
+        version(version),
+        used(0),
+        left(nullptr),
+        right(nullptr) {}
+
+    RedBlackNode* getChild(Mod type, int version) {
+        for(int i = used - 1; i >= 0; i--) {
+            if(mods[i].type == type && mods[i].version <= version) return mods[i].node;
+        }
+        return type == LEFT ? left : right;
+    }
+
+    RedBlackNode* getLeft(int version) {
+        return getChild(LEFT, version);
+    }
+
+    RedBlackNode* getRight(int version) {
+        return getChild(RIGHT, version);
+    }
+};
+
+// Updates only ever touch the latest version. A node created in the latest
+// version is not visible to older ones and is changed in place; an older node
+// takes a child change in its modification slot, and is copied when the slot
+// is taken or when its color changes, since colors are not versioned. Every
+// update works on the path from the root, held in a vector, and a copy is
+// linked into its parent through that path instead of parent pointers.
+// Any number of insertKey/eraseKey calls between beginVersion() and
+// publishVersion() build one version together.
+// Keys are ordered by the Compare object the tree holds; see PartialTree.
+template<typename Key, typename Compare = std::less<Key>, template<typename> class Alloc = Arena, int K = 1>
+struct RedBlackTree {
+
+    using Node = RedBlackNode<Key, K>;
+
+    Compare compare;
+    VersionTable<Node*> root;
+    Node* working;
+    int latestVersion;
+    bool balanced;
+    Alloc<Node> nodes;
+    TreeStats stats;
+
+    RedBlackTree(bool balanced = true, const Compare& compare = Compare()) :
+        compare(compare), working(nullptr), latestVersion(0), balanced(balanced) {
+        root.append(nullptr);
+    }
+
+    Node* copy(Node* node) {
+
+        TREE_COUNT(stats, CLONES, 1);
+        TREE_COUNT(stats, NODES, 1);
+        auto newNode = nodes.create(node->key, latestVersion);
+        newNode->color = node->color;
+        newNode->left = node->getLeft(INT_MAX);
+        newNode->right = node->getRight(INT_MAX);
+
+        return newNode;
+    }
+
+    Node* getRoot(int version) {
+        return root[version];
+    }
+
+    // The root of the version being built, published when the update ends.
+    Node* getRoot() {
+        return working;
+    }
+
+    Node* getLeft(Node* node, int version) {
+        return node == nullptr ? nullptr : node->getLeft(version);
+    }
+
+    Node* getRight(Node* node, int version) {
+        return node == nullptr ? nullptr : node->getRight(version);
+    }
+
+    Node* getLeft(Node* node) {
+        return getLeft(node, latestVersion);
+    }
+
+    Node* getRight(Node* node) {
+        return getRight(node, latestVersion);
+    }
+
+    Node* setChild(Node*, Mod, Node*);
+    Node* setLeft(Node*, Node*);
+    Node* setRight(Node*, Node*);
+    void relink(std::vector<Node*>&, int, Node*, Node*);
+    void setColor(std::vector<Node*>&, int, Color);
+    void leftRotate(std::vector<Node*>&, int);
+    void rightRotate(std::vector<Node*>&, int);
+    void setChildColor(std::vector<Node*>&, int, Node*, Color);
+    void setKey(std::vector<Node*>&, int, const Key&);
+    void fixInsert(std::vector<Node*>&);
+    void fixErase(std::vector<Node*>&, Node*, bool);
+
+    void beginVersion() {
+        latestVersion++;
+        working = getRoot(latestVersion - 1);
+    }
+
+    void publishVersion() {
+        root.append(working);
+        TREE_COUNT(stats, VERSIONS, 1);
+    }
+
+    void insert(const Key& key) {
+        beginVersion();
+        insertKey(key);
+        publishVersion();
+    }
+
+    void erase(const Key& key) {
+        beginVersion();
+        eraseKey(key);
+        publishVersion();
+    }
+
+    void insertKey(const Key& key) {
+
+        std::vector<Node*> path;
+        Node* node = getRoot();
+
+        while(node != nullptr) {
+            bool right = compare(node->key, key);
+            if(!right && !compare(key, node->key)) return;
+            path.push_back(node);
+            node = node->getChild(Mod(right), latestVersion);
+        }
+
+        node = nodes.create(key, latestVersion);
+        TREE_COUNT(stats, NODES, 1);
+        path.push_back(node);
+        relink(path, path.size() - 1, nullptr, node);
+
+        if(balanced) fixInsert(path);
+    }
+
+    void eraseKey(const Key& key) {
+
+        std::vector<Node*> path;
+        Node* node = getRoot();
+
+        while(node != nullptr) {
+            bool right = compare(node->key, key);
+            if(!right && !compare(key, node->key)) break;
+            path.push_back(node);
+            node = node->getChild(Mod(right), latestVersion);
+        }
+
+        if(node == nullptr) return;
+        path.push_back(node);
+
+        // With two children the successor's key moves up and the successor,
+        // which has no left child, is the node that is unlinked.
+        if(getLeft(node) != nullptr && getRight(node) != nullptr) {
+            int i = path.size() - 1;
+            auto succ = getRight(node);
+            path.push_back(succ);
+            while(getLeft(succ) != nullptr) {
+                succ = getLeft(succ);
+                path.push_back(succ);
+            }
+            setKey(path, i, succ->key);
+        }
+
+        node = path.back();
+        path.pop_back();
+
+        auto child = getLeft(node) != nullptr ? getLeft(node) : getRight(node);
+        bool childIsLeft = false;
+
+        if(path.empty()) {
+            working = child;
+        } else {
+            auto parent = path.back();
+            childIsLeft = getLeft(parent) == node;
+            auto updated = childIsLeft ? setLeft(parent, child) : setRight(parent, child);
+            if(updated != parent) relink(path, path.size() - 1, parent, updated);
+        }
+
+        if(balanced && node->color == BLACK) fixErase(path, child, childIsLeft);
+    }
+
+    bool count(const Key& key, int version) {
+
+        Node* node = getRoot(version);
+        int visited = 0;
+        bool found = false;
+
+        while(node != nullptr) {
+            visited++;
+            bool right = compare(node->key, key);
+            if(!right && !compare(key, node->key)) {
+                found = true;
+                break;
+            }
+            node = node->getChild(Mod(right), version);
+        }
+
+        TREE_COUNT(stats, FINDS, 1);
+        TREE_COUNT(stats, PATH_LENGTH, visited);
+        return found;
+    }
+
+    // The greatest key in the version for which below holds, where below
+    // holds for a prefix of the key order; nullptr if it holds for none.
+    template<typename Predicate>
+    const Key* last(Predicate below, int version) {
+        return last(below, getRoot(version), version);
+    }
+
+    // Sees the updates of the version being built.
+    template<typename Predicate>
+    const Key* last(Predicate below) {
+        return last(below, getRoot(), latestVersion);
+    }
+
+    template<typename Predicate>
+    const Key* last(Predicate below, Node* node, int version) {
+        const Key* found = nullptr;
+        int visited = 0;
+        while(node != nullptr) {
+            visited++;
+            bool right = below(node->key);
+            if(right) found = &node->key;
+            node = node->getChild(Mod(right), version);
+        }
+        TREE_COUNT(stats, FINDS, 1);
+        TREE_COUNT(stats, PATH_LENGTH, visited);
+        return found;
+    }
+
+    // The least key in the version for which above holds, where above holds
+    // for a suffix of the key order; nullptr if it holds for none.
+    template<typename Predicate>
+    const Key* first(Predicate above, int version) {
+        return first(above, getRoot(version), version);
+    }
+
+    // Sees the updates of the version being built.
+    template<typename Predicate>
+    const Key* first(Predicate above) {
+        return first(above, getRoot(), latestVersion);
+    }
+
+    template<typename Predicate>
+    const Key* first(Predicate above, Node* node, int version) {
+        const Key* found = nullptr;
+        int visited = 0;
+        while(node != nullptr) {
+            visited++;
+            bool left = above(node->key);
+            if(left) found = &node->key;
+            node = node->getChild(Mod(!left), version);
+        }
+        TREE_COUNT(stats, FINDS, 1);
+        TREE_COUNT(stats, PATH_LENGTH, visited);
+        return found;
+    }
+
+    // Visits the keys of a version in order.
+    template<typename Visit>
+    void forEach(Node* node, int version, Visit& visit) {
+        if(node == nullptr) return;
+        forEach(getLeft(node, version), version, visit);
+        visit(node->key);
+        forEach(getRight(node, version), version, visit);
+    }
+
+    template<typename Visit>
+    void forEach(int version, Visit visit) {
+        forEach(getRoot(version), version, visit);
+    }
+
+    int depth(Node* node, int version) {
+        if(node == nullptr) return 0;
+        return 1 + std::max(depth(getLeft(node, version), version), depth(getRight(node, version), version));
+    }
+
+    int depth(int version) {
+        return depth(getRoot(version), version);
+    }
+
+    // Returns the black height of the subtree, or -1 if it breaks ordering,
+    // has a red node with a red child, or has unequal black heights.
+    int blackHeight(Node* node, int version, const Node* low, const Node* high) {
+
+        if(node == nullptr) return 1;
+        if((low && !compare(low->key, node->key)) || (high && !compare(node->key, high->key))) return -1;
+
+        auto left = getLeft(node, version), right = getRight(node, version);
+        if(node->color == RED && ((left && left->color == RED) || (right && right->color == RED))) return -1;
+
+        int l = blackHeight(left, version, low, node);
+        int r = blackHeight(right, version, node, high);
+        if(l == -1 || r == -1 || l != r) return -1;
+
+        return l + (node->color == BLACK);
+    }
+
+    bool isValid(int version) {
+        auto node = getRoot(version);
+        if(node != nullptr && node->color != BLACK) return false;
+        return blackHeight(node, version, nullptr, nullptr) != -1;
+    }
+};
+
+// A slot this version already filled for the same side is overwritten, so
+// however often one update changes a child, the node takes at most one slot
+// per side; see PartialTree::setChild.
+template<typename Key, typename Compare, template<typename> class Alloc, int K>
+auto RedBlackTree<Key, Compare, Alloc, K>::setChild(Node* node, Mod type, Node* child) -> Node* {
+
+    if(node->getChild(type, latestVersion) == child) return node;
+
+    if(node->version == latestVersion) {
+        (type == LEFT ? node->left : node->right) = child;
+        return node;
+    }
+
+    for(int i = node->used - 1; i >= 0 && node->mods[i].version == latestVersion; i--) {
+        if(node->mods[i].type == type) {
+            node->mods[i].node = child;
+            return node;
+        }
+    }
+
+    if(node->used < K) {
+        node->mods[node->used].type = type;
+        node->mods[node->used].version = latestVersion;
+        node->mods[node->used].node = child;
+        node->used++;
+        TREE_COUNT(stats, SLOTS_FILLED, 1);
+        return node;
+    }
+
+    TREE_COUNT(stats, SLOTS_OVERFLOWED, 1);
+    auto newNode = copy(node);
+    (type == LEFT ? newNode->left : newNode->right) = child;
+    return newNode;
+}
+
+template<typename Key, typename Compare, template<typename> class Alloc, int K>
+auto RedBlackTree<Key, Compare, Alloc, K>::setLeft(Node* node, Node* left) -> Node* {
+    return setChild(node, LEFT, left);
+}
+
+template<typename Key, typename Compare, template<typename> class Alloc, int K>
+auto RedBlackTree<Key, Compare, Alloc, K>::setRight(Node* node, Node* right) -> Node* {
+    return setChild(node, RIGHT, right);
+}
+
+// path[i] was replaced by node; points its parent (or the root) at node,
+// cascading upwards while parents have to be copied.
+template<typename Key, typename Compare, template<typename> class Alloc, int K>
+void RedBlackTree<Key, Compare, Alloc, K>::relink(std::vector<Node*> &path, int i, Node* old, Node* node) {
+
+    path[i] = node;
+
+    if(i == 0) {
+        working = node;
+        return;
+    }
+
+    auto parent = path[i-1];
+    bool isLeft = old == nullptr ? compare(node->key, parent->key) : getLeft(parent) == old;
+    auto updated = isLeft ? setLeft(parent, node) : setRight(parent, node);
+
+    if(updated != parent) relink(path, i - 1, parent, updated);
+}
+
+template<typename Key, typename Compare, template<typename> class Alloc, int K>
+void RedBlackTree<Key, Compare, Alloc, K>::setColor(std::vector<Node*> &path, int i, Color color) {
+
+    auto node = path[i];
+    if(node->color == color) return;
+
+    if(node->version == latestVersion) {
+        node->color = color;
+        return;
+    }
+
+    auto newNode = copy(node);
+    newNode->color = color;
+    relink(path, i, node, newNode);
+}
+
+// Rotates path[i] with its right child, which takes its place in the path.
+template<typename Key, typename Compare, template<typename> class Alloc, int K>
+void RedBlackTree<Key, Compare, Alloc, K>::leftRotate(std::vector<Node*> &path, int i) {
+
+    auto node = path[i];
+    auto right = getRight(node);
+
+    auto left = setRight(node, getLeft(right));
+    auto top = setLeft(right, left);
+
+    relink(path, i, node, top);
+}
+
+// Rotates path[i] with its left child, which takes its place in the path.
+template<typename Key, typename Compare, template<typename> class Alloc, int K>
+void RedBlackTree<Key, Compare, Alloc, K>::rightRotate(std::vector<Node*> &path, int i) {
+
+    auto node = path[i];
+    auto left = getLeft(node);
+
+    auto right = setLeft(node, getRight(left));
+    auto top = setRight(left, right);
+
+    relink(path, i, node, top);
+}
+
+// Recolors the child of path[i]; the path is cut back to path[i].
+template<typename Key, typename Compare, template<typename> class Alloc, int K>
+void RedBlackTree<Key, Compare, Alloc, K>::setChildColor(std::vector<Node*> &path, int i, Node* child, Color color) {
+    path.resize(i + 1);
+    path.push_back(child);
+    setColor(path, i + 1, color);
+    path.pop_back();
+}
+
+template<typename Key, typename Compare, template<typename> class Alloc, int K>
+void RedBlackTree<Key, Compare, Alloc, K>::setKey(std::vector<Node*> &path, int i, const Key& key) {
+
+    auto node = path[i];
+
+    if(node->version == latestVersion) {
+        node->key = key;
+        return;
+    }
+
+    auto newNode = copy(node);
+    newNode->key = key;
+    relink(path, i, node, newNode);
+}
+
+template<typename Key, typename Compare, template<typename> class Alloc, int K>
+void RedBlackTree<Key, Compare, Alloc, K>::fixInsert(std::vector<Node*> &path) {
+
+    int i = path.size() - 1;
+
+    while(i >= 2 && path[i-1]->color == RED) {
+
+        int parent = i - 1, grand = i - 2;
+        bool parentIsLeft = getLeft(path[grand]) == path[parent];
+        auto uncle = parentIsLeft ? getRight(path[grand]) : getLeft(path[grand]);
+
+        if(uncle != nullptr && uncle->color == RED) {
+            setColor(path, parent, BLACK);
+            path.resize(grand + 1);
+            path.push_back(uncle);
+            setColor(path, grand + 1, BLACK);
+            path.pop_back();
+            setColor(path, grand, RED);
+            i = grand;
+            continue;
+        }
+
+        if(parentIsLeft && path[i] == getRight(path[parent])) leftRotate(path, parent);
+        if(!parentIsLeft && path[i] == getLeft(path[parent])) rightRotate(path, parent);
+
+        setColor(path, parent, BLACK);
+        setColor(path, grand, RED);
+        if(parentIsLeft) rightRotate(path, grand);
+        else leftRotate(path, grand);
+        break;
+    }
+
+    path.resize(1);
+    path[0] = getRoot();
+    setColor(path, 0, BLACK);
+}
+
+template<typename Node>
+bool isBlack(Node* node) {
+    return node == nullptr || node->color == BLACK;
+}
+
+// x took the place of a removed black node below path.back() and is one
+// black short. At most three rotations are done, and the recoloring loop
+// moves up only while it removes a black level, so the number of nodes
+// touched (and hence copied) per erase is O(1) amortized.
+template<typename Key, typename Compare, template<typename> class Alloc, int K>
+void RedBlackTree<Key, Compare, Alloc, K>::fixErase(std::vector<Node*> &path, Node* x, bool xIsLeft) {
+
+    int p = path.size() - 1;
+
+    while(p >= 0 && isBlack(x)) {
+
+        if(xIsLeft) {
+            auto w = getRight(path[p]);
+            if(w->color == RED) {
+                setChildColor(path, p, w, BLACK);
+                setColor(path, p, RED);
+                leftRotate(path, p);
+                path.push_back(getLeft(path[p]));
+                p++;
+                w = getRight(path[p]);
+            }
+            if(isBlack(getLeft(w)) && isBlack(getRight(w))) {
+                setChildColor(path, p, w, RED);
+                x = path[p];
+                path.pop_back();
+                p--;
+                xIsLeft = p >= 0 && getLeft(path[p]) == x;
+                continue;
+            }
+            if(isBlack(getRight(w))) {
+                path.push_back(w);
+                setChildColor(path, p + 1, getLeft(w), BLACK);
+                setColor(path, p + 1, RED);
+                rightRotate(path, p + 1);
+                path.pop_back();
+                w = getRight(path[p]);
+            }
+            path.push_back(w);
+            setColor(path, p + 1, path[p]->color);
+            setChildColor(path, p + 1, getRight(path[p + 1]), BLACK);
+            path.pop_back();
+            setColor(path, p, BLACK);
+            leftRotate(path, p);
+        } else {
+            auto w = getLeft(path[p]);
+            if(w->color == RED) {
+                setChildColor(path, p, w, BLACK);
+                setColor(path, p, RED);
+                rightRotate(path, p);
+                path.push_back(getRight(path[p]));
+                p++;
+                w = getLeft(path[p]);
+            }
+            if(isBlack(getLeft(w)) && isBlack(getRight(w))) {
+                setChildColor(path, p, w, RED);
+                x = path[p];
+                path.pop_back();
+                p--;
+                xIsLeft = p >= 0 && getLeft(path[p]) == x;
+                continue;
+            }
+            if(isBlack(getLeft(w))) {
+                path.push_back(w);
+                setChildColor(path, p + 1, getRight(w), BLACK);
+                setColor(path, p + 1, RED);
+                leftRotate(path, p + 1);
+                path.pop_back();
+                w = getLeft(path[p]);
+            }
+            path.push_back(w);
+            setColor(path, p + 1, path[p]->color);
+            setChildColor(path, p + 1, getLeft(path[p + 1]), BLACK);
+            path.pop_back();
+            setColor(path, p, BLACK);
+            rightRotate(path, p);
+        }
+
+        x = nullptr;
+        p = -1;
+        break;
+    }
+
+    if(x != nullptr && x->color == RED) {
+        if(p >= 0) setChildColor(path, p, xIsLeft ? getLeft(path[p]) : getRight(path[p]), BLACK);
+        else {
+            path.assign(1, getRoot());
+            setColor(path, 0, BLACK);
+        }
+    }
+}
@@ -0,0 +1,140 @@
+// On-disk snapshots of a tree's whole version history
+
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A snapshot is a header, the version root table and an array of fixed-size
+// node records, each part starting on an 8-byte boundary. Links are record
+// indices (NullRecord for none), so the file is used exactly as it lies in
+// memory: mapping it is the whole load, and find() runs on the mapping.
+// Integers are stored in native byte order.
+static const uint32_t NullRecord = UINT32_MAX;
+static const uint32_t RetiredVersion = UINT32_MAX - 1;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t slots;
+    uint32_t versions;
+    uint64_t nodes;
+    uint64_t rootsOffset;
+    uint64_t nodesOffset;
+    uint64_t extraOffset;
+};
+
+inline uint64_t alignSnapshot(uint64_t offset) {
+    return (offset + 7) & ~uint64_t(7);
+}
+
+// The file is written under a temporary name and renamed over the old
+// snapshot once it is on disk, so a crash never leaves a half-written one.
+struct SnapshotWriter {
+
+    std::string path;
+    FILE* file;
+    uint64_t offset;
+
+    SnapshotWriter(const std::string& path) : path(path), file(fopen((path + ".tmp").c_str(), "wb")), offset(0) {
+        if(file == nullptr) throw std::runtime_error("cannot create " + path);
+    }
+
+    ~SnapshotWriter() {
+        if(file != nullptr) {
+            fclose(file);
+            remove((path + ".tmp").c_str());
+        }
+    }
+
+    uint64_t write(const void* data, size_t size) {
+        static const char zeros[8] = {};
+        uint64_t start = alignSnapshot(offset);
+        if(start != offset) fwrite(zeros, 1, start - offset, file);
+        if(size > 0 && fwrite(data, 1, size, file) != size) throw std::runtime_error("snapshot write failed");
+        offset = start + size;
+        return start;
+    }
+
+    void finish(const SnapshotHeader& header) {
+        fseek(file, 0, SEEK_SET);
+        fwrite(&header, sizeof(header), 1, file);
+        bool written = fflush(file) == 0 && fsync(fileno(file)) == 0;
+        written = fclose(file) == 0 && written;
+        file = nullptr;
+        if(!written || rename((path + ".tmp").c_str(), path.c_str()) != 0) throw std::runtime_error("snapshot write failed");
+    }
+};
+
+// Read-only mapping of a snapshot file.
+struct MappedFile {
+
+    const char* data;
+    size_t size;
+
+    MappedFile(const std::string& path, const char* magic) : data(nullptr), size(0) {
+
+        int fd = open(path.c_str(), O_RDONLY);
+        if(fd < 0) throw std::runtime_error("cannot open " + path);
+
+        struct stat st;
+        fstat(fd, &st);
+        size = st.st_size;
+
+        void* mapped = size >= sizeof(SnapshotHeader) ? mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+        close(fd);
+        if(mapped == MAP_FAILED) throw std::runtime_error("cannot map " + path);
+        data = static_cast<const char*>(mapped);
+
+        if(memcmp(header().magic, magic, 8) != 0) {
+            munmap(const_cast<char*>(data), size);
+            throw std::runtime_error(path + " is not a snapshot of this tree");
+        }
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        munmap(const_cast<char*>(data), size);
+    }
+
+    const SnapshotHeader& header() const {
+        return *reinterpret_cast<const SnapshotHeader*>(data);
+    }
+
+    // Whether count records of the given size starting at offset lie inside
+    // the file and on the 8-byte boundary the writer puts them at.
+    bool holds(uint64_t offset, uint64_t count, size_t record) const {
+        return offset % 8 == 0 && offset <= size && count <= (size - offset) / record;
+    }
+
+    // Checks the header's parts against the mapped size before anything is
+    // read from them: the root table, nodes records of nodeSize bytes and,
+    // if extraSize is given, that many bytes per version at extraOffset.
+    void check(size_t nodeSize, size_t extraSize = 0) const {
+        auto& h = header();
+        bool whole = holds(h.rootsOffset, h.versions, sizeof(uint32_t)) && holds(h.nodesOffset, h.nodes, nodeSize) &&
+                     (extraSize == 0 || holds(h.extraOffset, h.versions, extraSize));
+        if(!whole) throw std::runtime_error("snapshot is truncated or corrupt");
+    }
+
+    template<typename T>
+    const T* at(uint64_t offset) const {
+        return reinterpret_cast<const T*>(data + offset);
+    }
+
+    uint32_t root(int version) const {
+        uint32_t node = version >= 0 && (uint32_t)version < header().versions ? at<uint32_t>(header().rootsOffset)[version] : RetiredVersion;
+        if(node == RetiredVersion) throw std::out_of_range("unknown version " + std::to_string(version));
+        return node;
+    }
+};
@@ -0,0 +1,93 @@
+// Instrumentation counters for the persistent trees
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+// Counting is compiled in only with -DTREE_STATS; otherwise TREE_COUNT expands
+// to nothing and the trees run exactly as before. Counters are sharded by
+// thread, one cache line per shard, so concurrent readers counting their
+// searches do not contend on a shared line.
+#ifdef TREE_STATS
+#define TREE_COUNT(stats, counter, n) (stats).add(TreeStats::counter, n)
+#else
+#define TREE_COUNT(stats, counter, n) ((void)0)
+#endif
+
+struct TreeStats {
+
+    enum Counter {
+        VERSIONS,           // versions created
+        NODES,              // nodes allocated, copies included
+        CLONES,             // nodes copied instead of changed in place
+        SLOTS_FILLED,       // child changes absorbed by a modification slot
+        SLOTS_OVERFLOWED,   // child changes that found every slot taken
+        FINDS,              // searches
+        PATH_LENGTH,        // nodes visited by those searches
+        ANCESTOR_CHECKS,    // version ancestry tests (full persistence)
+        COUNTERS
+    };
+
+    static const int Shards = 16;
+
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> counts[COUNTERS];
+    };
+
+    Shard shards[Shards];
+
+    TreeStats() {
+        reset();
+    }
+
+    static int shard() {
+        static std::atomic<int> threads(0);
+        thread_local int index = threads.fetch_add(1) % Shards;
+        return index;
+    }
+
+    void add(Counter counter, uint64_t n) {
+        shards[shard()].counts[counter].fetch_add(n, std::memory_order_relaxed);
+    }
+
+    uint64_t operator[](Counter counter) const {
+        uint64_t sum = 0;
+        for(auto& s : shards) sum += s.counts[counter].load(std::memory_order_relaxed);
+        return sum;
+    }
+
+    void reset() {
+        for(auto& s : shards) {
+            for(auto& c : s.counts) c.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    static bool enabled() {
+#ifdef TREE_STATS
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    std::string json() const {
+        auto& stats = *this;
+        auto ratio = [](uint64_t a, uint64_t b) { return b == 0 ? 0.0 : double(a) / b; };
+        std::ostringstream out;
+        out << "{\"enabled\": " << (enabled() ? "true" : "false")
+            << ", \"versions\": " << stats[VERSIONS]
+            << ", \"nodes\": " << stats[NODES]
+            << ", \"nodesPerVersion\": " << ratio(stats[NODES], stats[VERSIONS])
+            << ", \"clones\": " << stats[CLONES]
+            << ", \"slotsFilled\": " << stats[SLOTS_FILLED]
+            << ", \"slotsOverflowed\": " << stats[SLOTS_OVERFLOWED]
+            << ", \"finds\": " << stats[FINDS]
+            << ", \"pathLength\": " << stats[PATH_LENGTH]
+            << ", \"averagePath\": " << ratio(stats[PATH_LENGTH], stats[FINDS])
+            << ", \"ancestorChecks\": " << stats[ANCESTOR_CHECKS] << "}";
+        return out.str();
+    }
+};
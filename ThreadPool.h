@@ -0,0 +1,68 @@
+// Fixed-size pool of worker threads
+
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Tasks are taken in submission order by whichever worker is free. submit()
+// hands back a future that rethrows the task's exception, if it threw. The
+// destructor runs every task still queued before joining the workers.
+struct ThreadPool {
+
+    std::vector<std::thread> workers;
+    std::queue<std::packaged_task<void()>> tasks;
+    std::mutex lock;
+    std::condition_variable ready;
+    bool stopping;
+
+    ThreadPool(unsigned threads = std::thread::hardware_concurrency()) : stopping(false) {
+        threads = std::max(threads, 1u);
+        for(unsigned i = 0; i < threads; i++) workers.emplace_back([this]() { work(); });
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        ready.notify_all();
+        for(auto& worker : workers) worker.join();
+    }
+
+    template<typename Task>
+    std::future<void> submit(Task task) {
+        std::packaged_task<void()> job(std::move(task));
+        auto done = job.get_future();
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            tasks.push(std::move(job));
+        }
+        ready.notify_one();
+        return done;
+    }
+
+    size_t size() const {
+        return workers.size();
+    }
+
+    void work() {
+        for(;;) {
+            std::packaged_task<void()> job;
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                ready.wait(guard, [this]() { return stopping || !tasks.empty(); });
+                if(tasks.empty()) return;
+                job = std::move(tasks.front());
+                tasks.pop();
+            }
+            job();
+        }
+    }
+};
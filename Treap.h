@@ -0,0 +1,195 @@
+// Fully persistent treap with split and join
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <stdexcept>
+#include <utility>
+
+#include "Arena.h"
+#include "Stats.h"
+#include "VersionTable.h"
+
+// Nodes never change once built, so a node is only its key, its priority and
+// its two children: no modification slots and no version labels.
+template<typename Key>
+struct TreapNode {
+
+    Key key;
+    uint32_t priority;
+    TreapNode *left, *right;
+
+    TreapNode(const Key& key, uint32_t priority, TreapNode* left, TreapNode* right) :
+        key(key), priority(priority), left(left), right(right) {}
+};
+
+// Balanced engine for full persistence: a treap with path copying. An update
+// copies the O(log n) nodes on its path and leaves the rest shared, so any
+// version, or two of them, can be the parent of a new one, and random
+// priorities keep every version at expected O(log n) depth whatever order a
+// branch inserts its keys in. That makes split and join of whole versions
+// O(log n) as well, and moving a key range between versions a constant
+// number of them. FullTree keeps its fat nodes for concurrent writers and
+// the journal; this engine has one writer.
+//
+// Every update makes a version, as in FullTree, so the caller always gets an
+// id back: an insert of a key the parent already has, or an erase of one it
+// lacks, makes a version sharing the parent's root and copies nothing.
+//
+// Keys are ordered by Compare, a function object kept in the tree as in
+// PartialTree. Nodes come from Alloc, an arena with the interface of Arena.
+template<typename Key, typename Compare = std::less<Key>, template<typename> class Alloc = Arena>
+struct Treap {
+
+    using Node = TreapNode<Key>;
+
+    Compare compare;
+    VersionTable<Node*> root;
+    Alloc<Node> nodes;
+    std::mt19937 gen;
+    TreeStats stats;
+
+    Treap(uint32_t seed = std::random_device()(), const Compare& compare = Compare()) : compare(compare), gen(seed) {
+        root.append(nullptr);
+    }
+
+    // Highest version id handed out so far.
+    int lastVersion() const {
+        return root.size() - 1;
+    }
+
+    Node* createNode(const Key& key) {
+        TREE_COUNT(stats, NODES, 1);
+        return nodes.create(key, (uint32_t)gen(), nullptr, nullptr);
+    }
+
+    // A copy of node with new children.
+    Node* with(Node* node, Node* left, Node* right) {
+        TREE_COUNT(stats, NODES, 1);
+        TREE_COUNT(stats, CLONES, 1);
+        return nodes.create(node->key, node->priority, left, right);
+    }
+
+    // Keys below key (and key itself if inclusive) go left, the rest right.
+    std::pair<Node*, Node*> split(Node* node, const Key& key, bool inclusive = false) {
+        if(!node) return {nullptr, nullptr};
+        if(compare(node->key, key) || (inclusive && !compare(key, node->key))) {
+            auto parts = split(node->right, key, inclusive);
+            return {with(node, node->left, parts.first), parts.second};
+        }
+        auto parts = split(node->left, key, inclusive);
+        return {parts.first, with(node, parts.second, node->right)};
+    }
+
+    // Every key in a must be below every key in b.
+    Node* join(Node* a, Node* b) {
+        if(!a) return b;
+        if(!b) return a;
+        if(a->priority > b->priority) return with(a, a->left, join(a->right, b));
+        return with(b, join(a, b->left), b->right);
+    }
+
+    Node* first(Node* node) {
+        while(node && node->left) node = node->left;
+        return node;
+    }
+
+    Node* last(Node* node) {
+        while(node && node->right) node = node->right;
+        return node;
+    }
+
+    int addVersion(Node* node) {
+        TREE_COUNT(stats, VERSIONS, 1);
+        return root.append(node);
+    }
+
+    // The node holding key, or nullptr; visited counts the nodes on the way.
+    Node* lookup(Node* node, const Key& key, int& visited) {
+        while(node) {
+            visited++;
+            bool right = compare(node->key, key);
+            if(!right && !compare(key, node->key)) return node;
+            node = right ? node->right : node->left;
+        }
+        return nullptr;
+    }
+
+    bool find(const Key& key, int version) {
+        int visited = 0;
+        bool found = lookup(root[version], key, visited);
+        TREE_COUNT(stats, FINDS, 1);
+        TREE_COUNT(stats, PATH_LENGTH, visited);
+        return found;
+    }
+
+    // The new version's id, which the caller gets back.
+    int insert(const Key& key, int version) {
+        int visited = 0;
+        if(lookup(root[version], key, visited)) return addVersion(root[version]);
+        auto parts = split(root[version], key);
+        return addVersion(join(join(parts.first, createNode(key)), parts.second));
+    }
+
+    int erase(const Key& key, int version) {
+        int visited = 0;
+        if(!lookup(root[version], key, visited)) return addVersion(root[version]);
+        auto lower = split(root[version], key);
+        auto upper = split(lower.second, key, true);
+        return addVersion(join(lower.first, upper.second));
+    }
+
+    // Returns two new versions: the keys of version below key, and the rest.
+    std::pair<int, int> split(int version, const Key& key) {
+        auto parts = split(root[version], key);
+        int low = addVersion(parts.first);
+        int high = addVersion(parts.second);
+        return {low, high};
+    }
+
+    // Returns a new version holding the keys of both; every key of v1 has to
+    // be below every key of v2.
+    int join(int v1, int v2) {
+        auto a = last(root[v1]), b = first(root[v2]);
+        if(a && b && !compare(a->key, b->key)) throw std::invalid_argument("join: key ranges overlap");
+        return addVersion(join(root[v1], root[v2]));
+    }
+
+    // Moves the keys in [lo, hi) from version from into version to, which must
+    // have none of its own there. Returns the new versions of from and to.
+    std::pair<int, int> moveRange(int from, int to, const Key& lo, const Key& hi) {
+        auto source = split(root[from], lo);
+        auto range = split(source.second, hi);
+        auto target = split(root[to], lo);
+        auto rest = split(target.second, hi);
+        if(rest.first) throw std::invalid_argument("moveRange: target already has keys in range");
+        int left = addVersion(join(source.first, range.second));
+        int right = addVersion(join(join(target.first, range.first), rest.second));
+        return {left, right};
+    }
+
+    int depth(Node* node) {
+        return node ? 1 + std::max(depth(node->left), depth(node->right)) : 0;
+    }
+
+    int depth(int version) {
+        return depth(root[version]);
+    }
+
+    // Visits the keys of a version in order.
+    template<typename Visit>
+    void forEach(Node* node, Visit& visit) {
+        if(!node) return;
+        forEach(node->left, visit);
+        visit(node->key);
+        forEach(node->right, visit);
+    }
+
+    template<typename Visit>
+    void forEach(int version, Visit visit) {
+        forEach(root[version], visit);
+    }
+};
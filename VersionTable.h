@@ -0,0 +1,122 @@
+// Dense table of version roots
+
+#pragma once
+
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Versions are consecutive integers, so their roots live in fixed-size chunks
+// found through a flat directory: a lookup is two loads and never allocates.
+// Slots are reserved with an atomic counter and published with a release
+// store, so writers can append concurrently and readers only ever see roots
+// that were completely published. Unknown versions are rejected, and so are
+// versions that have been retracted.
+template<typename T, int ChunkBits = 12, int DirectoryBits = 14>
+struct VersionTable {
+
+    static const int ChunkSize = 1 << ChunkBits;
+    static const int MaxChunks = 1 << DirectoryBits;
+
+    // Pointer roots are atomic, so a root can be replaced under readers.
+    using Value = typename std::conditional<std::is_trivially_copyable<T>::value, std::atomic<T>, T>::type;
+
+    struct Entry {
+        Value value{};
+        std::atomic<bool> ready{false};
+    };
+
+    std::atomic<Entry*> chunks[MaxChunks];
+    std::atomic<int> reserved;
+
+    VersionTable() : reserved(0) {
+        for(auto& chunk : chunks) chunk.store(nullptr, std::memory_order_relaxed);
+    }
+
+    VersionTable(const VersionTable&) = delete;
+    VersionTable& operator=(const VersionTable&) = delete;
+
+    ~VersionTable() {
+        free(detach());
+    }
+
+    Entry* chunk(int c) {
+        Entry* entries = chunks[c].load(std::memory_order_acquire);
+        if(entries != nullptr) return entries;
+        Entry* fresh = new Entry[ChunkSize];
+        if(chunks[c].compare_exchange_strong(entries, fresh, std::memory_order_acq_rel)) return fresh;
+        delete[] fresh;
+        return entries;
+    }
+
+    // Claims the next version number; its root is invisible until published.
+    int reserve() {
+        int version = reserved.fetch_add(1);
+        if(version >= ChunkSize * MaxChunks) throw std::length_error("version table is full");
+        chunk(version >> ChunkBits);
+        return version;
+    }
+
+    void publish(int version, const T& value) {
+        Entry& entry = chunk(version >> ChunkBits)[version & (ChunkSize - 1)];
+        entry.value = value;
+        entry.ready.store(true, std::memory_order_release);
+    }
+
+    int append(const T& value) {
+        int version = reserve();
+        publish(version, value);
+        return version;
+    }
+
+    const Entry* find(int version) const {
+        if(version < 0 || version >= reserved.load(std::memory_order_acquire)) return nullptr;
+        const Entry* entries = chunks[version >> ChunkBits].load(std::memory_order_acquire);
+        if(entries == nullptr) return nullptr;
+        const Entry& entry = entries[version & (ChunkSize - 1)];
+        return entry.ready.load(std::memory_order_acquire) ? &entry : nullptr;
+    }
+
+    bool contains(int version) const {
+        return find(version) != nullptr;
+    }
+
+    T operator[](int version) const {
+        const Entry* entry = find(version);
+        if(entry == nullptr) throw std::out_of_range("unknown version " + std::to_string(version));
+        return entry->value;
+    }
+
+    void retract(int version) {
+        if(find(version) == nullptr) return;
+        chunks[version >> ChunkBits].load()[version & (ChunkSize - 1)].ready.store(false, std::memory_order_release);
+    }
+
+    int size() const {
+        return reserved.load(std::memory_order_acquire);
+    }
+
+    size_t bytes() const {
+        size_t count = 0;
+        for(auto& chunk : chunks) count += chunk.load(std::memory_order_relaxed) != nullptr;
+        return sizeof(*this) + count * ChunkSize * sizeof(Entry);
+    }
+
+    // Empties the table and hands back its chunks, to be freed with free()
+    // once no reader can still be looking at them.
+    std::vector<Entry*> detach() {
+        std::vector<Entry*> out;
+        reserved.store(0);
+        for(auto& chunk : chunks) {
+            Entry* entries = chunk.exchange(nullptr);
+            if(entries != nullptr) out.push_back(entries);
+        }
+        return out;
+    }
+
+    static void free(const std::vector<Entry*>& detached) {
+        for(Entry* entries : detached) delete[] entries;
+    }
+};
@@ -9,405 +9,963 @@
 #include <fstream>
 #include <chrono>
 #include <thread>
+#include <cmath>
+#include <stdexcept>
+#include <tuple>
+#include <climits>
+#include <cstdint>
+#include <type_traits>
+#include <unordered_map>
+#include <charconv>
+#include <cctype>
+#include <cstdio>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "RedBlackTree.h"
+#include "ThreadPool.h"
+
 using namespace std;
 
 mt19937 rng(chrono::steady_clock::now().time_since_epoch().count());
 
-enum Mod {
-    LEFT, RIGHT, EMPTY
-};
-int xglobe=0;
+using Segment = pair<pair<int, int>, pair<int, int>>;
+
+using int128 = __int128;
+
+// Coordinates must lie within +-coordinateLimit for the predicates below to
+// be exact in 128-bit arithmetic.
+const int coordinateLimit = 1 << 23;
+
+// A point with rational coordinates x / d and y / d, d > 0. Endpoints have
+// d = 1; a crossing of two segments needs up to 73 bits above a 49-bit d.
+struct Point {
+
+    int128 x, y, d;
 
-struct Modification;
-struct Node;
-struct Tree;
+    Point(pair<int, int> point) : x(point.first), y(point.second), d(1) {}
+    Point(int128 x, int128 y, int128 d) : x(x), y(y), d(d) {}
 
-struct Modification {
+    bool operator<(const Point& other) const {
+        if(x * other.d != other.x * d) return x * other.d < other.x * d;
+        return y * other.d < other.y * d;
+    }
+
+    bool sameX(const Point& other) const {
+        return x * other.d == other.x * d;
+    }
 
-    int version;
-    Mod type;
-    shared_ptr<Node> node;
+    bool operator==(const Point& other) const {
+        return x * other.d == other.x * d && y * other.d == other.y * d;
+    }
+
+    double X() const { return double(x) / double(d); }
 
-    Modification() : version(0), type(EMPTY), node(nullptr) {} 
+    // x as a double that compares with every integer exactly as x does:
+    // x itself when it is one, else halfway between its floor and ceiling.
+    // X() can round a crossing just left of an integer onto it.
+    double slabKey() const {
+        int128 q = x / d, r = x % d;
+        if(r == 0) return double(q);
+        if(r < 0) q--;
+        return double(q) + 0.5;
+    }
+    double Y() const { return double(y) / double(d); }
 };
 
-struct Node {
+// A segment together with its line dx * y = dy * x + c, dx > 0, so that the
+// predicates multiply where they used to divide.
+struct Line {
 
-    pair<pair<int, int>, pair<int, int>> key;//line
-    shared_ptr<Node> left, right;
-    shared_ptr<Modification> mod;
+    Segment segment;
+    pair<int, int> left, right;
+    long long dx, dy, c;
 
-    Node(pair<pair<int, int>, pair<int, int>> key) : key(key), left(nullptr), right(nullptr), mod(make_shared<Modification>()) {}
+    Line(const Segment& segment) : segment(segment) {
+        tie(left, right) = segment.first.first <= segment.second.first ? segment : Segment(segment.second, segment.first);
+        dx = right.first - left.first;
+        dy = right.second - left.second;
+        c = dx * left.second - dy * left.first;
+    }
 };
 
-struct Tree {
-    
-    int currentVersion;
-    map<int, shared_ptr<Node>> root;
+// 1 if the point lies above the line, 0 on it, -1 below.
+int side(const Line& line, const Point& point) {
+    int128 v = line.dx * point.y - line.dy * point.x - line.c * point.d;
+    return (v > 0) - (v < 0);
+}
 
-    Tree() : currentVersion(0) { root[0] = nullptr; }
+bool checkAbove(const Line& line,pair<int,int> point) {
+    return line.dx * point.second - line.dy * point.first >= line.c;
+}
 
-    shared_ptr<Node> clone(const shared_ptr<Node>& node) {
-        auto newNode = make_shared<Node>(node->key);
-        newNode->left = node->mod->type == LEFT ? node->mod->node : node->left;
-        newNode->right = node->mod->type == RIGHT ? node->mod->node : node->right;
-        return newNode;
+// Orders segments bottom to top by where they cross the vertical line at
+// x / d, which the sweep moves before every update. Segments meeting there
+// are ordered as just after it, or as just before it while the sweep erases.
+// Both sides are scaled by d and the two dx, so no division is needed.
+struct SegmentOrder {
+
+    int128 x = 0, d = 1;
+    bool before = false;
+
+    bool operator()(const Line& key1, const Line& key2) const {//is below
+        int128 y1 = (key1.dy * x + key1.c * d) * key2.dx;
+        int128 y2 = (key2.dy * x + key2.c * d) * key1.dx;
+        if(y1 != y2) return y1 < y2;
+        long long slope1 = key1.dy * key2.dx, slope2 = key2.dy * key1.dx;
+        if(slope1 != slope2) return before ? slope1 > slope2 : slope1 < slope2;
+        return key1.segment < key2.segment;
     }
+};
+
+struct Tree : RedBlackTree<Line, SegmentOrder> {
 
-    shared_ptr<Node> getRoot() {
-        auto it = root.rbegin();
-        return it->second;
+    // The segment right below the point in the given version; an empty
+    // segment if none in the version is at or below it.
+    Segment find(pair<int,int> point, int version) {
+        auto line = last([&](const Line& key) { return checkAbove(key, point); }, version);
+        return line ? line->segment : Segment();
     }
 
-    shared_ptr<Node> getLeft(const shared_ptr<Node>& node, int version) {
-        if(node->mod->type == LEFT && node->mod->version <= version) return node->mod->node;
-        return node->left;
+    void inorder(int version) {
+        forEach(version, [](const Line& key) {
+            auto& line = key.segment;
+            cout << "Line: (" << line.first.first << "," << line.first.second << ") -> (" << line.second.first << "," << line.second.second << ")" << endl;
+        });
+        cout << endl;
     }
+};
+
+// A point where segments start, end or cross. through holds the segments
+// passing through it, version the tree version once the sweep is past it.
+struct Event {
+
+    Point point = Point(0, 0, 1);
+    vector<Line> starts, ends, through;
+    int version = 0;
 
-    shared_ptr<Node> getRight(const shared_ptr<Node>& node, int version) {
-        if(node->mod->type == RIGHT && node->mod->version <= version) return node->mod->node;
-        return node->right;
+    bool crossing() const {
+        return starts.size() + ends.size() + through.size() > 1;
     }
+};
 
-    shared_ptr<Node> getLeft(const shared_ptr<Node>& node) {
-        if(node->mod->type == LEFT) return node->mod->node;
-        return node->left;
+// Where two non-parallel segments meet, if they do: Cramer's rule on their
+// line equations, with the common denominator kept positive.
+bool intersect(const Line& a, const Line& b, Point& point) {
+    int128 d = int128(b.dy) * a.dx - int128(a.dy) * b.dx;
+    if(d == 0) return false;
+    int128 x = int128(a.c) * b.dx - int128(b.c) * a.dx;
+    int128 y = int128(b.dy) * a.c - int128(a.dy) * b.c;
+    if(d < 0) x = -x, y = -y, d = -d;
+    for(auto line : {&a, &b}) {
+        if(x < line->left.first * d || x > line->right.first * d) return false;
     }
+    point = Point(x, y, d);
+    return true;
+}
 
-    shared_ptr<Node> getRight(const shared_ptr<Node>& node) {
-        if(node->mod->type == RIGHT) return node->mod->node;
-        return node->right;
+// Bentley-Ottmann sweep over the segments in O((n + k) log n) for k
+// intersections; vertical segments are left out. The status line is the
+// tree itself, a red-black tree so that it stays O(log n) deep however the
+// segments start (many at one x would otherwise arrive in sorted order):
+// at every event the segments ending at or passing through the point are
+// erased in their order just before it, and those starting at or passing
+// through it inserted in their order just after it, so the passing ones swap.
+// Only segments that become neighbours are tested for a crossing further
+// right. Events reach visit in x order (then y). All the events at one x,
+// however many, make a single version, and they are visited once it is
+// committed, so the tree's versions are the slabs of a point location
+// structure. All tests are exact, so segments through a common
+// point meet in a single event.
+template<typename Visit>
+void sweep(Tree& tree, const vector<Segment>& segments, Visit visit) {
+
+    map<Point, Event> queue;
+    for(auto& segment : segments) {
+        for(auto end : {segment.first, segment.second}) {
+            if(abs(end.first) > coordinateLimit || abs(end.second) > coordinateLimit) throw out_of_range("segment coordinate out of range");
+        }
+        // A vertical segment spans no slab, so no query can land below it.
+        if(segment.first.first == segment.second.first) continue;
+        Line line(segment);
+        queue[line.left].starts.push_back(line);
+        queue[line.right].ends.push_back(line);
     }
 
-    shared_ptr<Node> setLeft(const shared_ptr<Node>& node, const shared_ptr<Node>& left) {
-        
-        if(getLeft(node) == left) return node;
+    auto check = [&](const Line* a, const Line* b, const Point& current) {
+        Point point = current;
+        if(!a || !b || !intersect(*a, *b, point)) return;
+        if(current < point) queue[point];
+    };
 
-        if(node->mod->type == EMPTY) {
-            node->mod->type = LEFT;
-            node->mod->node = left;
-            node->mod->version = currentVersion;
-            return node;
-        }
+    while(!queue.empty()) {
 
-        auto newNode = clone(node);
-        newNode->left = left;
-        return newNode;
-    }
+        // Every event on this vertical line goes into one version.
+        Point step = queue.begin()->first;
+        vector<Event> events;
+        tree.beginVersion();
+
+        while(!queue.empty() && queue.begin()->first.sameX(step)) {
+
+            Event event = move(queue.begin()->second);
+            event.point = queue.begin()->first;
+            queue.erase(queue.begin());
+            const Point& point = event.point;
+
+            SegmentOrder before{point.x, point.d, true}, after{point.x, point.d, false};
+
+            // The segments through the point are contiguous in the status.
+            tree.compare = before;
+            auto line = tree.first([&](const Line& key) { return side(key, point) <= 0; });
+            while(line && side(*line, point) == 0) {
+                auto current = *line;
+                if(!(Point(current.right) == point)) event.through.push_back(current);
+                line = tree.first([&](const Line& key) { return before(current, key); });
+            }
 
-    shared_ptr<Node> setRight(const shared_ptr<Node>& node, const shared_ptr<Node>& right) {
-        
-        if(getRight(node) == right) return node;
+            for(auto& line : event.ends) tree.eraseKey(line);
+            for(auto& line : event.through) tree.eraseKey(line);
+            tree.compare = after;
+            for(auto& line : event.starts) tree.insertKey(line);
+            for(auto& line : event.through) tree.insertKey(line);
+
+            vector<Line> entered = event.starts;
+            entered.insert(entered.end(), event.through.begin(), event.through.end());
+            if(entered.empty()) {
+                auto below = tree.last([&](const Line& key) { return side(key, point) > 0; });
+                auto above = tree.first([&](const Line& key) { return side(key, point) < 0; });
+                check(below, above, point);
+            } else {
+                auto [lowest, highest] = minmax_element(entered.begin(), entered.end(), after);
+                auto below = tree.last([&](const Line& key) { return after(key, *lowest); });
+                auto above = tree.first([&](const Line& key) { return after(*highest, key); });
+                check(below, &*lowest, point);
+                check(&*highest, above, point);
+            }
 
-        if(node->mod->type == EMPTY) {
-            node->mod->type = RIGHT;
-            node->mod->node = right;
-            node->mod->version = currentVersion;
-            return node;
+            events.push_back(move(event));
         }
 
-        auto newNode = clone(node);
-        newNode->right = right;
-        return newNode;
-    }
-    double Ycord(pair<pair<int, int>, pair<int, int>> key){
-        int x1 = key.first.first;
-        int y1 = key.first.second;
-        int x2 = key.second.first;
-        int y2 = key.second.second;
-        return (1.0*(y2-y1)*(xglobe-x1))/(1.0*(x2-x1))+y1;
-    }
-    bool isLess(pair<pair<int, int>, pair<int, int>> key1,pair<pair<int, int>, pair<int, int>> key2) {//is below
-        return Ycord(key1) < Ycord(key2);
+        tree.publishVersion();
+        for(auto& event : events) {
+            event.version = tree.latestVersion;
+            visit(event);
+        }
     }
-    shared_ptr<Node> insertKey(const shared_ptr<Node>& node, pair<pair<int, int>, pair<int, int>> key) {
+}
 
-        if(!node) return make_shared<Node>(key);
+// The slab ends in a static B+-tree of 64-byte blocks of eight, stored root
+// first, so a search reads one cache line per level (seven for a million
+// slabs) instead of taking a branch per halving. Each key of an inner block
+// is the largest end below the corresponding child; blocks are padded with
+// infinity. A block is searched by counting its keys below x, with two AVX2
+// compares when the build targets AVX2 and a plain loop otherwise.
+struct SlabDirectory {
 
-        // if(key < node->key) {
-        if(isLess(key,node->key)) {
-            auto left = insertKey(getLeft(node), key);
-            return setLeft(node, left);
-        }
+    static const int B = 8;
 
-        // if(key > node->key) {
-        if(isLess(node->key,key)) {
-            auto right = insertKey(getRight(node), key);
-            return setRight(node, right);
+    struct alignas(64) Block {
+        double keys[B];
+    };
+
+    vector<Block> blocks;
+    vector<size_t> levels;  // offset of each level in blocks, root first
+    size_t count = 0;
+    double first = 0, last = 0;
+
+    void build(const vector<double>& ends) {
+        count = ends.size();
+        blocks.clear();
+        levels.clear();
+        if(ends.empty()) return;
+        first = ends.front();
+        last = ends.back();
+        vector<vector<Block>> tree(1);
+        for(size_t i = 0; i < ends.size(); i += B) {
+            Block block;
+            for(int j = 0; j < B; j++) block.keys[j] = i + j < ends.size() ? ends[i + j] : INFINITY;
+            tree[0].push_back(block);
+        }
+        while(tree.back().size() > 1) {
+            auto& children = tree.back();
+            vector<Block> parents;
+            for(size_t i = 0; i < children.size(); i += B) {
+                Block block;
+                for(int j = 0; j < B; j++) block.keys[j] = i + j < children.size() ? children[i + j].keys[B - 1] : INFINITY;
+                parents.push_back(block);
+            }
+            tree.push_back(move(parents));
+        }
+        for(auto level = tree.rbegin(); level != tree.rend(); level++) {
+            levels.push_back(blocks.size());
+            blocks.insert(blocks.end(), level->begin(), level->end());
         }
+    }
+
+    static int below(const Block& block, double x) {
+#ifdef __AVX2__
+        __m256d key = _mm256_set1_pd(x);
+        int low = _mm256_movemask_pd(_mm256_cmp_pd(_mm256_load_pd(block.keys), key, _CMP_LT_OQ));
+        int high = _mm256_movemask_pd(_mm256_cmp_pd(_mm256_load_pd(block.keys + 4), key, _CMP_LT_OQ));
+        return __builtin_popcount(low | high << 4);
+#else
+        int n = 0;
+        for(int j = 0; j < B; j++) n += block.keys[j] < x;
+        return n;
+#endif
+    }
 
-        return node;
+    // The last slab whose end is less than x, or the first slab if none is.
+    // There must be at least one slab.
+    size_t slab(double x) const {
+        // Past the last end the padding would lead the descent off the
+        // leaves; short of it, some key of every block on the way is >= x.
+        if(count == 0 || x > last) return count == 0 ? 0 : count - 1;
+        size_t block = 0;
+        for(size_t level : levels) block = block * B + below(blocks[level + block], x);
+        return block > 0 ? block - 1 : 0;
     }
+};
 
-    shared_ptr<Node> deleteKey(const shared_ptr<Node>& node,  pair<pair<int, int>, pair<int, int>> key) {
+// A read-only copy of the slab versions of a tree, for an index that is
+// built once and then only queried. Nodes sit in one array in breadth-first
+// order from the slab roots, so the top levels every query passes through
+// share a few cache lines, and point to each other by 32-bit index. Each
+// keeps the line coefficients checkAbove needs and its one modification
+// slot inline; the segments themselves, needed only for the answer, are in
+// a parallel array. A node takes 40 bytes against about 100 in the tree.
+struct FrozenIndex {
+
+    static const uint32_t None = UINT32_MAX;
+
+    struct Node {
+        long long c;
+        int dx, dy;
+        uint32_t child[2];
+        uint32_t modChild;  // replaces child[modSide] from modVersion on
+        int modVersion, modSide;
+    };
 
-        if(!node) return nullptr;
+    static_assert(extent<decltype(Tree::Node::mods)>::value == 1, "frozen nodes keep a single slot");
 
-        // if(key < node->key) {
-        if(isLess(key,node->key)) {
-            auto left = deleteKey(getLeft(node), key);
-            return setLeft(node, left);
-        }
+    // What a query needs from its slab, in one place.
+    struct Slab {
+        uint32_t root;
+        int version;
+    };
 
-        // if(key > node->key) {
-        if(isLess(node->key,key)) {
-            auto right = deleteKey(getRight(node), key);
-            return setRight(node, right);
+    vector<Node> nodes;
+    vector<Segment> segments;
+    SlabDirectory directory;
+    vector<Slab> slabs;
+
+    void freeze(Tree& tree, const vector<double>& ends, const vector<int>& versions) {
+
+        directory.build(ends);
+
+        unordered_map<Tree::Node*, uint32_t> index;
+        vector<Tree::Node*> order;
+        auto visit = [&](Tree::Node* node) {
+            if(!node) return None;
+            auto [it, added] = index.emplace(node, order.size());
+            if(added) order.push_back(node);
+            return it->second;
+        };
+
+        for(int version : versions) slabs.push_back({visit(tree.root[version]), version});
+        // order grows as the loop goes, which makes it the queue of the search.
+        for(size_t i = 0; i < order.size(); i++) {
+            auto node = order[i];
+            visit(node->left);
+            visit(node->right);
+            if(node->used > 0) visit(node->mods[0].node);
         }
 
-        if(!getLeft(node)) return getRight(node);
-        if(!getRight(node)) return getLeft(node);
+        nodes.resize(order.size());
+        segments.resize(order.size());
+        for(size_t i = 0; i < order.size(); i++) {
+            auto node = order[i];
+            auto& line = node->key;
+            auto& frozen = nodes[i];
+            frozen.c = line.c;
+            frozen.dx = line.dx;
+            frozen.dy = line.dy;
+            frozen.child[0] = visit(node->left);
+            frozen.child[1] = visit(node->right);
+            frozen.modChild = None;
+            frozen.modVersion = INT_MAX;
+            frozen.modSide = 0;
+            if(node->used > 0) {
+                frozen.modChild = visit(node->mods[0].node);
+                frozen.modVersion = node->mods[0].version;
+                frozen.modSide = node->mods[0].type;
+            }
+            segments[i] = line.segment;
+        }
+    }
 
-        auto succ = getRight(node);
-        while(getLeft(succ)) succ = getLeft(succ);
+    // Answers as PlanarIndex::locate does.
+    Segment locate(pair<int,int> point) const {
+        if(slabs.empty() || point.first <= directory.first) return {};
+        auto slab = slabs[directory.slab(point.first)];
+        uint32_t found = None;
+        int version = slab.version;
+        for(uint32_t i = slab.root; i != None; ) {
+            auto& node = nodes[i];
+            int right = (long long)node.dx * point.second - (long long)node.dy * point.first >= node.c;
+            if(right) found = i;
+            i = node.modSide == right && node.modVersion <= version ? node.modChild : node.child[right];
+        }
+        return found == None ? Segment() : segments[found];
+    }
+};
 
-        auto newNode = make_shared<Node>(succ->key);
-        newNode->left = getLeft(node);
+// A point location structure over one set of segments. Everything it
+// depends on, the sweep position included, lives in the index, so separate
+// indexes can be built on separate threads. Every version of the sweep
+// starts a slab; its end is kept as a slab key, so queries, which have
+// integer x, pick their slab exactly even where two ends share a double.
+struct PlanarIndex {
 
-        auto right = deleteKey(getRight(node), succ->key);
-        newNode->right = right;
+    Tree tree;
+    vector<double> slabEnds;
+    vector<int> slabVersions;
+    SlabDirectory directory;
 
-        return newNode;
+    void build(const vector<Segment>& lines) {
+        build(lines, [](const Event&) {});
     }
-    double Ycordx(pair<pair<int, int>, pair<int, int>> line,int x) {
-        int x1 = line.first.first;
-        int y1 = line.first.second;
-        int x2 = line.second.first;
-        int y2 = line.second.second;
-        return (1.0*(y2-y1)*(x-x1))/(1.0*(x2-x1))+y1;
+
+    // Hands every event of the sweep to visit as well, after its slab is
+    // recorded.
+    template<typename Visit>
+    void build(const vector<Segment>& lines, Visit visit) {
+        sweep(tree, lines, [&](const Event& event) {
+            if(slabVersions.empty() || slabVersions.back() != event.version) {
+                slabEnds.push_back(event.point.slabKey());
+                slabVersions.push_back(event.version);
+            }
+            visit(event);
+        });
+        directory.build(slabEnds);
     }
-    bool checkAbove(pair<pair<int, int>, pair<int, int>> line,pair<int,int> point) {
-        return point.second >= Ycordx(line,point.first);
+
+    // The segment right below the point, taken from the last slab that
+    // starts left of it; an empty segment if there is no such slab or no
+    // segment in it at or below the point.
+    Segment locate(pair<int,int> point) {
+        if(slabEnds.empty() || point.first <= slabEnds[0]) return {};
+        return tree.find(point, slabVersions[directory.slab(point.first)]);
     }
-    pair<pair<int, int>, pair<int, int>> find(pair<int,int> point, int version) {
-        auto node = root[version];
-        pair<pair<int, int>, pair<int, int>> line;
-        line = node->key;
-        while(node) {
-            if(checkAbove(node->key,point)) {
-                line = node->key;
-                node = getRight(node, version);
-            }
-            else node = getLeft(node, version);
-            // auto kk = node->key;
-            // cout << "Line: (" << kk.first.first << "," << kk.first.second << ") -> (" << kk.second.first << "," << kk.second.second << ")" << endl;
-        }
-        return line;
+
+    FrozenIndex freeze() {
+        FrozenIndex frozen;
+        frozen.freeze(tree, slabEnds, slabVersions);
+        return frozen;
     }
+};
 
-    void insert(pair<pair<int, int>, pair<int, int>> key) {
-        currentVersion++;
-        root[currentVersion] = insertKey(getRoot(), key);
+// Builds an index per tile (say, the tiles of a map) on the pool's workers.
+// Rethrows the first failure once every build has finished.
+vector<PlanarIndex> buildIndexes(ThreadPool& pool, const vector<vector<Segment>>& tiles) {
+    vector<PlanarIndex> indexes(tiles.size());
+    vector<future<void>> builds;
+    for(size_t i = 0; i < tiles.size(); i++) {
+        builds.push_back(pool.submit([&indexes, &tiles, i]() { indexes[i].build(tiles[i]); }));
     }
+    for(auto& build : builds) build.wait();
+    for(auto& build : builds) build.get();
+    return indexes;
+}
 
-    void erase(pair<pair<int, int>, pair<int, int>> key) {
-        currentVersion++;
-        root[currentVersion] = deleteKey(getRoot(), key);
+void printLine(const Segment& line) {
+    cout << "Line: (" << line.first.first << "," << line.first.second << ") -> (" << line.second.first << "," << line.second.second << ")" << endl;
+}
+
+// Builds the demo index over the lines and the boundaries, printing every
+// event of the sweep and then the segments of each slab.
+void preprocess(PlanarIndex& index, vector<Segment>& lines) {
+    // Define boundaries: x and y range from 0 to 100
+    lines.push_back(make_pair(make_pair(0, 0), make_pair(100, 0)));
+    lines.push_back(make_pair(make_pair(0, 100), make_pair(100, 100)));
+    // The sweep hands over intersections and endpoints in x order; the tree
+    // version made by the events at an x covers the slab to its right.
+    vector<double> slabEnds;
+    index.build(lines, [&](const Event& event) {
+        double x = event.point.X(), y = event.point.Y();
+        if(event.crossing()) {
+            cout << "Intersection point: " << x << "," << y << endl;
+            for(auto& line : event.ends) printLine(line.segment);
+            for(auto& line : event.through) printLine(line.segment);
+            for(auto& line : event.starts) printLine(line.segment);
+        } else {
+            cout << "Just a line at " << x << endl;
+            printLine((event.starts.empty() ? event.ends[0] : event.starts[0]).segment);
+        }
+        if(slabEnds.size() < index.slabEnds.size()) slabEnds.push_back(x);
+    });
+    cout << "Slab ends: ";
+    for(auto i : slabEnds) {
+        cout << i << " ";
+    }
+    cout <<endl;
+    for(size_t i = 0; i < slabEnds.size(); i++) {
+        cout << "slab: " << slabEnds[i] << " version: " << index.slabVersions[i] << endl;
+        index.tree.inorder(index.slabVersions[i]);
     }
+}
+
+// Builds random tiles one after the other and then on a pool, and checks
+// that both answer the same.
+void testTiles(int count, int segments) {
 
-    void inorder(const shared_ptr<Node>& node, int version) {
-        if(!node) return;
-        inorder(getLeft(node, version), version);
-        auto line = node->key;
-        cout << "Line: (" << line.first.first << "," << line.first.second << ") -> (" << line.second.first << "," << line.second.second << ")" << endl;
-        inorder(getRight(node, version), version);
+    mt19937 gen(1);
+    vector<vector<Segment>> tiles(count);
+    for(auto& tile : tiles) {
+        for(int i = 0; i < segments; i++) {
+            int x = gen() % 100000, y = gen() % 100000;
+            tile.push_back({{x, y}, {x + 1 + int(gen() % 1000), y + int(gen() % 1000) - 500}});
+        }
     }
 
-    void inorder(int version) {
-        inorder(root[version], version);
-        cout << endl;
+    auto start = chrono::steady_clock::now();
+    vector<PlanarIndex> sequential(count);
+    for(int i = 0; i < count; i++) sequential[i].build(tiles[i]);
+    double one = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    ThreadPool pool;
+    start = chrono::steady_clock::now();
+    auto parallel = buildIndexes(pool, tiles);
+    double many = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    for(int i = 0; i < count; i++) {
+        for(int j = 0; j < 1000; j++) {
+            pair<int,int> point(gen() % 100000, gen() % 100000);
+            if(sequential[i].locate(point) != parallel[i].locate(point)) {
+                cout << "Tile " << i << " answers differ at " << point.first << "," << point.second << endl;
+                exit(1);
+            }
+        }
     }
-};
 
-// Function to find intersections
-void findIntersections(
-    vector<pair<pair<int, int>, pair<int, int>>> lines,
-    map<pair<int, int>, pair<pair<pair<int, int>, pair<int, int>>, pair<pair<int, int>, pair<int, int>>>>& intersections) {
-    
-    for (int i = 0; i < lines.size(); i++) {
-        for (int j = i + 1; j < lines.size(); j++) {
-            int x1 = lines[i].first.first;
-            int y1 = lines[i].first.second;
-            int x2 = lines[i].second.first;
-            int y2 = lines[i].second.second;
-            int x3 = lines[j].first.first;
-            int y3 = lines[j].first.second;
-            int x4 = lines[j].second.first;
-            int y4 = lines[j].second.second;
-
-            // Line equation coefficients
-            int a1 = y2 - y1;
-            int b1 = x1 - x2;
-            int c1 = a1 * x1 + b1 * y1;
-
-            int a2 = y4 - y3;
-            int b2 = x3 - x4;
-            int c2 = a2 * x3 + b2 * y3;
-
-            int det = a1 * b2 - a2 * b1;
-            if (det == 0) {
-                // Lines are parallel or coincident
-                continue;
+    cout << count << " tiles of " << segments << " segments: " << one << " s one by one, "
+         << many << " s on " << pool.size() << " threads" << endl;
+}
+
+// A size x size lattice with the edges and both diagonals of every cell, so
+// every x is shared by many endpoints and crossings, and three or more
+// segments meet at most points. Times the build and checks random queries
+// against a scan of all segments, and the frozen index against the tree.
+void benchmarkGrid(int size) {
+
+    const int step = 10;
+    vector<Segment> lines;
+    for(int i = 0; i < size; i++) {
+        for(int j = 0; j < size; j++) {
+            int x = i * step, y = j * step;
+            if(i + 1 < size) lines.push_back({{x, y}, {x + step, y}});
+            if(j + 1 < size) lines.push_back({{x, y}, {x, y + step}});
+            if(i + 1 < size && j + 1 < size) {
+                lines.push_back({{x, y}, {x + step, y + step}});
+                lines.push_back({{x, y + step}, {x + step, y}});
             }
+        }
+    }
 
-            // Calculate intersection point
-            int x = (b2 * c1 - b1 * c2) / det;
-            int y = (a1 * c2 - a2 * c1) / det;
+    PlanarIndex index;
+    auto start = chrono::steady_clock::now();
+    index.build(lines);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cout << lines.size() << " grid segments: " << index.slabEnds.size() << " slabs, "
+         << index.tree.latestVersion << " versions, " << index.tree.nodes.size() << " nodes, "
+         << seconds << " s" << endl;
+
+    // The height of a segment at x as a fraction, compared by cross-multiplying.
+    auto height = [](const Line& line, int x) { return make_pair(line.dy * x + line.c, line.dx); };
+    auto lower = [](pair<long long, long long> a, pair<long long, long long> b) { return a.first * b.second < b.first * a.second; };
+
+    FrozenIndex frozen = index.freeze();
+    mt19937 gen(1);
+    int extent = (size - 1) * step;
+    for(int i = 0; i < 1000; i++) {
+        pair<int,int> point(1 + gen() % extent, gen() % (extent + 1));
+        // The highest segment at or below the point, over the slab left of it.
+        vector<Line> below;
+        for(auto& segment : lines) {
+            Line line(segment);
+            if(line.dx == 0 || line.left.first >= point.first || line.right.first < point.first || !checkAbove(line, point)) continue;
+            if(below.empty() || lower(height(below[0], point.first), height(line, point.first))) below.assign(1, line);
+        }
+        if(frozen.locate(point) != index.locate(point)) {
+            cout << "Frozen grid query at " << point.first << "," << point.second << " differs from the tree" << endl;
+            exit(1);
+        }
+        if(below.empty()) {
+            if(index.locate(point) != Segment()) {
+                cout << "Grid query at " << point.first << "," << point.second << " found a segment where there is none" << endl;
+                exit(1);
+            }
+            continue;
+        }
+        auto expected = height(below[0], point.first), found = height(Line(index.locate(point)), point.first);
+        if(lower(expected, found) || lower(found, expected)) {
+            cout << "Grid query at " << point.first << "," << point.second << " found the wrong segment" << endl;
+            exit(1);
+        }
+    }
+}
 
-            // Check if the intersection point is within bounds
-            if (x >= 0 && x <= 100 && y >= 0 && y <= 100) {
-                intersections[{x, y}] = make_pair(lines[i], lines[j]);
+// Checks the slab directory against a binary search for sizes around whole
+// blocks and levels, at every end, between ends and past both sides.
+void testDirectory() {
+    for(int count : {1, 7, 8, 9, 16, 63, 64, 65, 72, 512, 513}) {
+        vector<double> ends;
+        for(int i = 0; i < count; i++) ends.push_back(2 * i);
+        SlabDirectory directory;
+        directory.build(ends);
+        for(int x = -2; x <= 2 * count + 2; x++) {
+            size_t slab = lower_bound(ends.begin(), ends.end(), x) - ends.begin();
+            if(slab > 0) slab--;
+            if(directory.slab(x) != slab) {
+                cout << "Slab directory of " << count << " ends finds slab " << directory.slab(x) << " for " << x << " instead of " << slab << endl;
+                exit(1);
             }
         }
     }
 }
-double findSlope(pair<pair<int, int>, pair<int, int>> line) {
-    return ((1.0*(line.second.second - line.first.second)) / (1.0*(line.second.first - line.first.first)));
+
+// Slab keys of crossings a hair to either side of an integer, closer than a
+// double can tell apart, still fall on the right side of it.
+void testSlabKeys() {
+    int128 d = int128(1) << 45;
+    for(int x : {-10000, -1, 0, 1, 10000, coordinateLimit}) {
+        Point below(x * d - 1, 0, d), at(x * d, 0, d), above(x * d + 1, 0, d);
+        if(!(below.slabKey() < x && below.slabKey() > x - 1 && at.slabKey() == x && above.slabKey() > x && above.slabKey() < x + 1)) {
+            cout << "Slab keys around " << x << " are on the wrong side" << endl;
+            exit(1);
+        }
+    }
 }
-bool touchSmallerX(pair<pair<int, int>, pair<int, int>> line,int slab) {
-    return (line.first.first == slab);
+
+// Points with no segment below them, beside the segments or under them,
+// get an empty answer from both indexes rather than some nearby segment.
+void testNothingBelow() {
+    Segment low = {{0, 10}, {100, 10}}, high = {{0, 50}, {100, 60}};
+    PlanarIndex index;
+    index.build({low, high});
+    FrozenIndex frozen = index.freeze();
+    vector<pair<pair<int,int>, Segment>> cases = {
+        {{50, 0}, {}}, {{-5, 20}, {}}, {{0, 20}, {}}, {{101, 70}, {}}, {{150, 70}, {}},
+        {{50, 10}, low}, {{50, 20}, low}, {{50, 55}, high}, {{100, 70}, high}
+    };
+    for(auto& [point, expected] : cases) {
+        if(index.locate(point) != expected || frozen.locate(point) != expected) {
+            cout << "Wrong segment below " << point.first << "," << point.second << endl;
+            exit(1);
+        }
+    }
 }
-bool repetitions(vector<int>v){
-    sort(v.begin(),v.end());
-    for(int i=0;i<v.size()-1;i++){
-        if(v[i]==v[i+1]){
-            return true;
+
+// Horizontal segments stacked on top of each other, all starting at x = 0,
+// enter the status line in sorted order; the tree must stay within the
+// red-black bound of 2 log2(n + 1) levels rather than become a path.
+void testStackedStarts() {
+    const int count = 1 << 14;
+    vector<Segment> lines;
+    for(int i = 0; i < count; i++) lines.push_back({{0, i}, {100 + i % 7, i}});
+    PlanarIndex index;
+    index.build(lines);
+    int depth = index.tree.depth(index.slabVersions[0]);
+    if(depth > 2 * log2(count + 1)) {
+        cout << "Status line of " << count << " stacked segments is " << depth << " deep" << endl;
+        exit(1);
+    }
+    for(int y : {0, 1, count / 2, count - 1}) {
+        if(index.locate({50, y}) != lines[y] || index.freeze().locate({50, y}) != lines[y]) {
+            cout << "Wrong segment below 50," << y << " among stacked segments" << endl;
+            exit(1);
         }
     }
-    return false;
 }
-void preprocess( Tree &tree ,vector<pair<pair<int, int>, pair<int, int>>> &lines,vector<int> &slabEnds,map<int,int> &slabToVersion) {
-    // Define boundaries: x and y range from 0 to 100
-    lines.push_back(make_pair(make_pair(0, 0), make_pair(100, 0)));
-    lines.push_back(make_pair(make_pair(0, 100), make_pair(100, 100)));
-    // Map to store intersection points and corresponding intersecting lines
-    map<pair<int, int>, pair<pair<pair<int, int>, pair<int, int>>, pair<pair<int, int>, pair<int, int>>>> intersections;
-
-    // Find intersections
-    findIntersections(lines, intersections);
-
-    // Print the intersection points and intersecting lines
-    for (auto i : intersections) {
-        cout << "Intersection point: " << i.first.first << "," << i.first.second << endl;
-        cout << "Line 1: (" << i.second.first.first.first << "," << i.second.first.first.second << ") -> ("
-             << i.second.first.second.first << "," << i.second.first.second.second << ")" << endl;
-        cout << "Line 2: (" << i.second.second.first.first << "," << i.second.second.first.second << ") -> ("
-             << i.second.second.second.first << "," << i.second.second.second.second << ")" << endl;
-    }
-    for(auto i : intersections) {
-        slabEnds.push_back(i.first.first);
-    }
-    sort(slabEnds.begin(), slabEnds.end());
-    if(repetitions(slabEnds)){
-        cout<<"Repetitions in slab ends"<<endl;
-        exit(0);
-    }
-    // if(slabEnds[intersections.size()-1] != 100)
-    //     slabEnds.push_back(100);
-    cout << "Slab ends: ";
-    for(auto i : slabEnds) {
-        cout << i << " ";
+
+// Freezes an index over random segments and checks that it answers every
+// query as the tree does, timing both on the same points, and the slab
+// directory against a binary search.
+void benchmarkFrozen(int segments, int queries) {
+
+    mt19937 gen(1);
+    vector<Segment> lines;
+    for(int i = 0; i < segments; i++) {
+        int x = gen() % 1000000, y = gen() % 1000000;
+        lines.push_back({{x, y}, {x + 1 + int(gen() % 10000), y + int(gen() % 10000) - 5000}});
     }
-    cout <<endl;
-    //insert the initial line
-    // xglobe=0;
-    // tree.insert(make_pair(make_pair(0, 0), make_pair(100, 0)));
-    int prev = 0;
-    int version = 0;
-    //insert all the lines where x axis of first line is 0
-    for(int i = 0; i < lines.size(); i++) {
-        if(lines[i].first.first == 0) {
-            xglobe=0;
-            tree.insert(lines[i]);
-            version++;
-        }
-    }
-    slabToVersion[0]=version;
-    for(auto slabs : slabEnds) {
-        version++;
-        //find a line that has an x axis value equal to the slab end
-        pair<pair<int, int>, pair<int, int>> line;
-        for(auto i : lines){
-            if(i.first.first == slabs || i.second.first == slabs) {
-                line = i;
-                break;
-            }
+
+    PlanarIndex index;
+    index.build(lines);
+    auto start = chrono::steady_clock::now();
+    FrozenIndex frozen = index.freeze();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    vector<pair<int,int>> points(queries);
+    for(auto& point : points) point = {int(gen() % 1000000), int(gen() % 1000000)};
+
+    auto time = [&](auto locate) {
+        long long sum = 0;
+        auto start = chrono::steady_clock::now();
+        for(auto& point : points) sum += locate(point).first.first;
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        return make_pair(seconds, sum);
+    };
+    auto [treeSeconds, treeSum] = time([&](pair<int,int> point) { return index.locate(point); });
+    auto [frozenSeconds, frozenSum] = time([&](pair<int,int> point) { return frozen.locate(point); });
+
+    // The slab search alone, against a binary search over the ends.
+    auto& ends = index.slabEnds;
+    size_t searched = 0, scanned = 0;
+    start = chrono::steady_clock::now();
+    for(auto& point : points) searched += index.directory.slab(point.first);
+    double directorySeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    start = chrono::steady_clock::now();
+    for(auto& point : points) {
+        size_t slab = lower_bound(ends.begin(), ends.end(), point.first) - ends.begin();
+        scanned += slab > 0 ? slab - 1 : 0;
+    }
+    double binarySeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if(searched != scanned) {
+        cout << "Slab directory disagrees with the binary search" << endl;
+        exit(1);
+    }
+
+    for(auto& point : points) {
+        if(index.locate(point) != frozen.locate(point) || treeSum != frozenSum) {
+            cout << "Frozen query at " << point.first << "," << point.second << " differs from the tree" << endl;
+            exit(1);
         }
-        if(line.first.first != slabs && line.second.first != slabs) {
-            pair<pair<int, int>, pair<int, int>> line1, line2;
-            for(auto i : intersections) {
-                if(i.first.first == slabs) {
-                    line1 = i.second.first;
-                    line2 = i.second.second;
-                    break;
-                }
-            }
-            cout << "intersection at " << slabs << endl;
-            cout << "Line1: (" << line1.first.first << "," << line1.first.second << ") -> (" << line1.second.first << "," << line1.second.second << ")" << endl;
-            cout << "Line2: (" << line2.first.first << "," << line2.first.second << ") -> (" << line2.second.first << "," << line2.second.second << ")" << endl;
-            xglobe=(prev+slabs)/2;
-            tree.erase(line1);
-            tree.erase(line2);
-            xglobe=slabs+1;
-            tree.insert(line1);
-            tree.insert(line2);
-            prev = slabs;
-            version+=3;
-            slabToVersion[slabs]=version;
-            continue;
+    }
+
+    cout << segments << " segments: " << index.tree.nodes.size() << " tree nodes, " << frozen.nodes.size()
+         << " frozen nodes, frozen in " << seconds << " s; " << queries << " queries in " << treeSeconds
+         << " s on the tree, " << frozenSeconds << " s frozen" << endl;
+    cout << index.slabEnds.size() << " slabs: " << directorySeconds << " s in the directory, "
+         << binarySeconds << " s by binary search" << endl;
+}
+
+// Query points for the headless mode: text with an "x y" pair per line (any
+// blanks or commas between numbers), or binary pairs of native 32-bit ints.
+// Both are read through a buffer, a batch at a time.
+struct PointReader {
+
+    FILE* in;
+    bool binary;
+    vector<char> buffer = vector<char>(1 << 20);
+    size_t begin = 0, end = 0;
+    bool done = false;
+
+    PointReader(FILE* in, bool binary) : in(in), binary(binary) {}
+
+    // Keeps at least a whole number in the buffer unless the input is over.
+    void fill() {
+        if(done || end - begin >= 32) return;
+        copy(buffer.begin() + begin, buffer.begin() + end, buffer.begin());
+        end -= begin;
+        begin = 0;
+        size_t n = fread(buffer.data() + end, 1, buffer.size() - end, in);
+        if(n == 0) done = true;
+        end += n;
+    }
+
+    bool number(int& value) {
+        for(;;) {
+            fill();
+            while(begin < end && (isspace((unsigned char)buffer[begin]) || buffer[begin] == ',')) begin++;
+            if(begin < end) break;
+            if(done) return false;
+        }
+        fill();
+        bool negative = buffer[begin] == '-';
+        if(negative || buffer[begin] == '+') begin++;
+        if(begin == end || !isdigit((unsigned char)buffer[begin])) throw invalid_argument("malformed query point");
+        long long v = 0;
+        while(begin < end && isdigit((unsigned char)buffer[begin])) {
+            v = v * 10 + (buffer[begin++] - '0');
+            if(v > INT_MAX) throw out_of_range("query coordinate out of range");
         }
-        cout << "Just a line at " << slabs << endl;
-        cout << "Line: (" << line.first.first << "," << line.first.second << ") -> (" << line.second.first << "," << line.second.second << ")" << endl;
-        if(touchSmallerX(line,slabs)){
-            xglobe=slabs+1;
-            tree.insert(line);
+        value = negative ? -v : v;
+        return true;
+    }
+
+    // Up to most points; fewer only at the end of the input.
+    size_t read(vector<pair<int,int>>& points, size_t most) {
+        points.clear();
+        if(binary) {
+            vector<int32_t> raw(2 * most);
+            size_t n = fread(raw.data(), 2 * sizeof(int32_t), most, in);
+            for(size_t i = 0; i < n; i++) points.push_back({raw[2 * i], raw[2 * i + 1]});
+            return n;
         }
-        else{
-            xglobe=(prev+slabs)/2;
-            tree.erase(line);
+        pair<int,int> point;
+        while(points.size() < most && number(point.first)) {
+            if(!number(point.second)) throw invalid_argument("query point without a y");
+            points.push_back(point);
         }
-        prev = slabs;
-        slabToVersion[slabs]=version;
+        return points.size();
     }
-    slabEnds.push_back(0);
-    sort(slabEnds.begin(), slabEnds.end());
-    for(auto i : slabToVersion) {
-        cout << "slab: " << i.first << " version: " << i.second << endl;
-        tree.inorder(i.second);
+};
+
+// Segments as x1 y1 x2 y2 per line, the format lines.py reads.
+vector<Segment> readSegments(const string& path) {
+    ifstream in(path);
+    if(!in) throw runtime_error("cannot open " + path);
+    vector<Segment> segments;
+    Segment segment;
+    while(in >> segment.first.first >> segment.first.second >> segment.second.first >> segment.second.second) {
+        segments.push_back(segment);
     }
+    return segments;
 }
-int lastSlabLess(vector<int> slabEnds,int slab) {//do binary search
-    int l = 0;
-    int r = slabEnds.size()-1;
-    int ans = 0;
-    while(l <= r) {
-        int mid = l + (r-l)/2;
-        if(slabEnds[mid] < slab) {
-            ans = mid;
-            l=mid+1;
+
+// The headless query engine: answers the points from in against a frozen
+// index, batchSize at a time, splitting each batch over the pool. Answers go
+// out in input order, as "x,y,x1,y1,x2,y2" lines or as four native 32-bit
+// ints (the segment) per point. A point with no segment at or below it, left
+// of every segment or past them all included, gets zeros.
+void streamQueries(const FrozenIndex& index, PointReader& in, FILE* out, bool binary, ThreadPool& pool) {
+
+    const size_t batchSize = 1 << 16;
+    vector<pair<int,int>> points;
+    vector<Segment> answers(batchSize);
+    vector<char> text;
+
+    while(size_t n = in.read(points, batchSize)) {
+
+        size_t chunk = (n + pool.size() - 1) / pool.size();
+        vector<future<void>> parts;
+        for(size_t first = 0; first < n; first += chunk) {
+            parts.push_back(pool.submit([&, first]() {
+                for(size_t i = first; i < min(n, first + chunk); i++) answers[i] = index.locate(points[i]);
+            }));
         }
-        else {
-            r=mid-1;
+        for(auto& part : parts) part.get();
+
+        if(binary) {
+            vector<int32_t> raw;
+            raw.reserve(4 * n);
+            for(size_t i = 0; i < n; i++) {
+                auto& line = answers[i];
+                raw.insert(raw.end(), {line.first.first, line.first.second, line.second.first, line.second.second});
+            }
+            fwrite(raw.data(), sizeof(int32_t), raw.size(), out);
+            continue;
         }
+
+        text.resize(n * 6 * 12);
+        char* p = text.data();
+        for(size_t i = 0; i < n; i++) {
+            auto& line = answers[i];
+            int fields[] = {points[i].first, points[i].second, line.first.first, line.first.second, line.second.first, line.second.second};
+            for(int field : fields) {
+                p = to_chars(p, p + 12, field).ptr;
+                *p++ = ',';
+            }
+            p[-1] = '\n';
+        }
+        fwrite(text.data(), 1, p - text.data(), out);
     }
-    return slabEnds[ans];
+    fflush(out);
 }
-pair<pair<int, int>, pair<int, int>> query(pair<int,int> point,vector<int> slabEnds,map<int,int> slabToVersion,Tree &tree) {
-    int slab = lastSlabLess(slabEnds,point.first);
-    // cout << "Slab: " << slab << endl;
-    int version = slabToVersion[slab];
-    // cout << "Version: " << version << endl;
-    // cout << "Inorder:" << endl;
-    // tree.inorder(slabToVersion[slab]);
-    pair<pair<int, int>, pair<int, int>> line = tree.find(point,version);
-    cout << "Point:" << point.first << "," << point.second << endl;
-    cout << "Line: (" << line.first.first << "," << line.first.second << ") -> (" << line.second.first << "," << line.second.second << ")" << endl;
-    pair<pair<int, int>, pair<int, int>> result = line;
-    cout << endl;
-    return result;
+
+// Writes the segments and the query point for lines.py and runs it.
+bool render(const vector<Segment>& lines, pair<int,int> point) {
+    // Write data to a file
+    std::ofstream outFile("input_data.txt");
+    if (!outFile) {
+        std::cerr << "Error: Could not open the file for writing.\n";
+        return false;
+    }
+
+    // Write lines to the file
+    for (const auto& line : lines) {
+        outFile << line.first.first << " " << line.first.second << " "
+                << line.second.first << " " << line.second.second << "\n";
+    }
+
+    // Write the point to the file
+    outFile << point.first << " " << point.second << "\n";
+    outFile.close();
+    // Execute the Python script
+
+    std::string command = "python3 lines.py";
+    int ret_code = std::system(command.c_str());
+    if (ret_code != 0) {
+        std::cerr << "Error: Python script execution failed.\n";
+        return false;
+    }
+    return true;
 }
 
-int main() {
+int main(int argc, char** argv) {
+
+    if(argc > 1 && string(argv[1]) == "tiles") {
+        testTiles(argc > 2 ? stoi(argv[2]) : 16, argc > 3 ? stoi(argv[3]) : 20000);
+        return 0;
+    }
+
+    if(argc > 1 && string(argv[1]) == "grid") {
+        benchmarkGrid(argc > 2 ? stoi(argv[2]) : 200);
+        return 0;
+    }
+
+    if(argc > 1 && string(argv[1]) == "frozen") {
+        testDirectory();
+        testSlabKeys();
+        testNothingBelow();
+        testStackedStarts();
+        benchmarkFrozen(argc > 2 ? stoi(argv[2]) : 100000, argc > 3 ? stoi(argv[3]) : 1000000);
+        return 0;
+    }
+
+    // planar_point query SEGMENTS [--points FILE] [--out csv|binary]
+    // Points come from FILE as binary pairs, or else from stdin as text.
+    if(argc > 2 && string(argv[1]) == "query") {
+        string points, format = "csv";
+        for(int i = 3; i < argc; i += 2) {
+            string arg = argv[i];
+            if(arg != "--points" && arg != "--out") {
+                cerr << "unknown option " << arg << endl;
+                return 1;
+            }
+            if(i + 1 == argc) {
+                cerr << arg << " needs a value" << endl;
+                return 1;
+            }
+            (arg == "--points" ? points : format) = argv[i + 1];
+        }
+        if(format != "csv" && format != "binary") {
+            cerr << "--out takes csv or binary" << endl;
+            return 1;
+        }
+        // Closed on every way out, errors included.
+        unique_ptr<FILE, int(*)(FILE*)> file(points.empty() ? nullptr : fopen(points.c_str(), "rb"), fclose);
+        if(!points.empty() && !file) {
+            cerr << "cannot open " << points << endl;
+            return 1;
+        }
+        try {
+            PlanarIndex index;
+            index.build(readSegments(argv[2]));
+            FrozenIndex frozen = index.freeze();
+            PointReader reader(file ? file.get() : stdin, !points.empty());
+            ThreadPool pool;
+            streamQueries(frozen, reader, stdout, format == "binary", pool);
+        } catch(const exception& e) {
+            cerr << e.what() << endl;
+            return 1;
+        }
+        return 0;
+    }
+
     vector<pair<pair<int, int>, pair<int, int>>> lines = {
         {{15, 0}, {82, 100}},  // Line 1
         {{5, 100}, {95, 0}},  // Line 2
@@ -422,10 +980,8 @@ int main() {
 
     pair<int,int> point;
 
-    Tree tree;
-    vector<int> slabEnds;
-    map<int,int> slabToVersion;
-    preprocess(tree,lines,slabEnds,slabToVersion);
+    PlanarIndex index;
+    preprocess(index, lines);
 
 
     for(int i=0;i<10;i++){
@@ -435,32 +991,12 @@ int main() {
         point.first = rng() % 96 + 2;
         point.second = rng() % 96 + 2;
         // cout << "Point: " << point.first << "," << point.second << endl;
-        pair<pair<int, int>, pair<int, int>> result = query(point,slabEnds,slabToVersion,tree);
+        Segment result = index.locate(point);
+        cout << "Point:" << point.first << "," << point.second << endl;
+        printLine(result);
+        cout << endl;
         lines.push_back(result);
-        // Write data to a file
-        std::ofstream outFile("input_data.txt");
-        if (!outFile) {
-            std::cerr << "Error: Could not open the file for writing.\n";
-            return 1;
-        }
-
-        // Write lines to the file
-        for (const auto& line : lines) {
-            outFile << line.first.first << " " << line.first.second << " "
-                    << line.second.first << " " << line.second.second << "\n";
-        }
-
-        // Write the point to the file
-        outFile << point.first << " " << point.second << "\n";
-        outFile.close();
-        // Execute the Python script
-
-        std::string command = "python3 lines.py";
-        int ret_code = std::system(command.c_str());
-        if (ret_code != 0) {
-            std::cerr << "Error: Python script execution failed.\n";
-            return 1;
-        }
+        if(!render(lines, point)) return 1;
         // Wait for 2 seconds before the next iteration
         std::this_thread::sleep_for(std::chrono::seconds(1));
         //remove the last line 